@@ -0,0 +1,543 @@
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+#include "INLINE.h"
+
+   #include <stdlib.h>
+   #include <string.h>
+   #include <fcntl.h>
+   #include <unistd.h>
+   #include <sys/stat.h>
+   #include <sys/mman.h>
+   #ifdef __linux__
+   #include <sys/sendfile.h>
+   #endif
+
+   // This is not thread-safe. MCE is configured to not use threads.
+
+   size_t m[127], s[127], bucket_size;
+   char **a[127];
+
+   // Bucket data is appended without locks. Each chunk reserves a range at
+   // the end of the bucket file with an atomic add on the shared end offset,
+   // then writes its bytes there with pwrite. The end offsets are mapped
+   // before MCE spawns the workers, which inherit the mapping.
+
+   size_t *bucket_end, *bucket_lines, *mem_state, l[127];
+   int bucket_fd[127];
+
+   void c_shared_init()
+   {
+      bucket_end = (size_t *) mmap(NULL, sizeof(size_t) * (127 * 2 + 3),
+         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+      memset(bucket_end, 0, sizeof(size_t) * (127 * 2 + 3));
+      bucket_lines = bucket_end + 127;
+      mem_state = bucket_end + 127 * 2;
+   }
+
+   size_t c_bucket_lines(size_t bucket)
+   {
+      return bucket_lines[bucket];
+   }
+
+   void c_set_fd(size_t bucket, int fd)
+   {
+      bucket_fd[bucket] = fd;
+   }
+
+   // Memory budget (-S). Bucket sorts are admitted in the order they take
+   // a ticket, which follows the list, largest first. Each waits until its
+   // reservation fits next to the sorts running, or nothing else runs.
+   // mem_state holds the bytes reserved, the next ticket and the ticket
+   // being served.
+
+   void c_mem_acquire(size_t need, size_t budget)
+   {
+      volatile size_t *state = mem_state;
+      size_t ticket = __sync_fetch_and_add(&mem_state[1], 1);
+
+      while (state[2] != ticket || (state[0] != 0 && state[0] + need > budget))
+         usleep(5000);
+
+      __sync_fetch_and_add(&mem_state[0], need);
+      __sync_fetch_and_add(&mem_state[2], 1);
+   }
+
+   void c_mem_release(size_t need)
+   {
+      __sync_fetch_and_sub(&mem_state[0], need);
+   }
+
+   double c_phys_mem()
+   {
+      return (double) sysconf(_SC_PHYS_PAGES) * sysconf(_SC_PAGESIZE);
+   }
+
+   static void write_bucket(size_t bucket)
+   {
+      size_t len = s[bucket], off;
+      char *p = (char *) a[bucket];
+      ssize_t w;
+
+      off = __sync_fetch_and_add(&bucket_end[bucket], len);
+      __sync_fetch_and_add(&bucket_lines[bucket], l[bucket]);
+
+      for (; len > 0; p += w, off += w, len -= w) {
+         if ((w = pwrite(bucket_fd[bucket], p, len, off)) <= 0)
+            break;
+      }
+
+      s[bucket] = l[bucket] = 0;
+   }
+
+   void c_init(size_t chunk_size)
+   {
+      size_t bucket;
+
+      for (bucket = 32; bucket < 127; bucket++)
+         m[bucket] = s[bucket] = l[bucket] = 0;
+
+      bucket_size = chunk_size + 256;
+   }
+
+   void c_end()
+   {
+      size_t bucket;
+
+      for (bucket = 32; bucket < 127; bucket++) {
+         if (m[bucket]) {
+            free((void *) a[bucket]);
+            m[bucket] = 0;
+         }
+      }
+   }
+
+   // The bucket of a line is its first character, or 32 for characters
+   // below a space.
+
+   static size_t bucket_of(char *line)
+   {
+      size_t bucket = line[0];
+
+      return (bucket < 32) ? 32 : bucket;
+   }
+
+   void c_part(size_t size, char *buffer)
+   {
+      size_t start_pos = 0, i, len, bucket;
+      char *p;
+
+      for (i = 0; i < size; i++) {
+         if (buffer[i] == '\n') {
+            bucket = bucket_of(buffer + start_pos);
+
+            if (! m[bucket]) {
+               a[bucket] = (char *) malloc(bucket_size);
+               m[bucket] = bucket_size;
+            }
+
+            p = a[bucket];  len = i - start_pos + 1;
+            memcpy(p + s[bucket], buffer + start_pos, sizeof(char) * len);
+            s[bucket] += len;  start_pos = i + 1;  l[bucket]++;
+         }
+      }
+
+      for (bucket = 32; bucket < 127; bucket++) {
+         if (s[bucket]) write_bucket(bucket);
+      }
+   }
+
+   // Stage A for --index. Partitions the lines starting in [lo, hi) of the
+   // input, read from a private mapping, appending to each line a NUL and
+   // its offset in the input as 16 hex digits. The sort binaries write the
+   // offsets into the index (--index-tags) and stop at the NUL otherwise.
+
+   #define TAG_LEN 17
+
+   void c_part_range(char *path, size_t lo, size_t hi)
+   {
+      static const char hex[] = "0123456789abcdef";
+      size_t size, i, j, k, len, bucket;
+      char *src, *p, *q;
+      struct stat st;
+      int fd;
+
+      if ((fd = open(path, O_RDONLY)) < 0)
+         return;
+
+      if (fstat(fd, &st) != 0 || (size = st.st_size) == 0) {
+         close(fd); return;
+      }
+
+      src = (char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+
+      if (src == MAP_FAILED)
+         return;
+
+      if (hi > size) hi = size;
+
+      // The first line starting at or after lo
+      if (lo == 0) {
+         i = 0;
+      } else {
+         p = (char *) memchr(src + lo - 1, '\n', size - lo + 1);
+         i = (p != NULL) ? p - src + 1 : size;
+      }
+
+      for (; i < hi; i = j) {
+         if ((p = (char *) memchr(src + i, '\n', size - i)) == NULL)
+            break;
+
+         j = p - src + 1;  len = j - i;
+         bucket = bucket_of(src + i);
+
+         if (s[bucket] + len + TAG_LEN > m[bucket]) {
+            if (s[bucket]) write_bucket(bucket);
+
+            if (len + TAG_LEN > m[bucket]) {
+               k = (len + TAG_LEN > bucket_size) ? len + TAG_LEN : bucket_size;
+               a[bucket] = (char **) ((m[bucket])
+                  ? realloc(a[bucket], k) : malloc(k));
+               m[bucket] = k;
+            }
+         }
+
+         q = (char *) a[bucket] + s[bucket];
+         memcpy(q, src + i, len - 1);  q += len - 1;  *q++ = '\0';
+
+         for (k = 0; k < 16; k++)
+            q[k] = hex[(i >> (60 - 4 * k)) & 15];
+
+         q[16] = '\n';
+         s[bucket] += len + TAG_LEN;  l[bucket]++;
+      }
+
+      for (bucket = 32; bucket < 127; bucket++) {
+         if (s[bucket]) write_bucket(bucket);
+      }
+
+      munmap(src, size);
+   }
+
+   // Split a bucket file by the second character of each line into files
+   // named path_C, C being the character code or 0 for one-character lines.
+   // Returns the sub-bucket, bytes and lines of each file written. The
+   // bucket file is removed afterwards.
+
+   AV * c_split(char *path)
+   {
+      AV *ret = newAV();
+
+      size_t bytes[256], lines[256], pos[256], size, i, j, c;
+      char *src, *dst, *p, name[4096];
+      struct stat st;
+      int fd;
+
+      if ((fd = open(path, O_RDONLY)) < 0)
+         return sv_2mortal(ret);
+
+      if (fstat(fd, &st) != 0 || (size = st.st_size) == 0) {
+         close(fd); return sv_2mortal(ret);
+      }
+
+      src = (char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+
+      if (src == MAP_FAILED || (dst = (char *) malloc(size)) == NULL) {
+         if (src != MAP_FAILED) munmap(src, size);
+         return sv_2mortal(ret);
+      }
+
+      memset(bytes, 0, sizeof(bytes));
+      memset(lines, 0, sizeof(lines));
+
+      for (i = 0; i < size; i = j) {
+         p = (char *) memchr(src + i, '\n', size - i);
+         j = (p != NULL) ? p - src + 1 : size;
+         c = (j - i > 2) ? (unsigned char) src[i + 1] : 0;
+         bytes[c] += j - i; lines[c]++;
+      }
+
+      for (c = 0, j = 0; c < 256; c++) {
+         pos[c] = j; j += bytes[c];
+      }
+
+      for (i = 0; i < size; i = j) {
+         p = (char *) memchr(src + i, '\n', size - i);
+         j = (p != NULL) ? p - src + 1 : size;
+         c = (j - i > 2) ? (unsigned char) src[i + 1] : 0;
+         memcpy(dst + pos[c], src + i, j - i); pos[c] += j - i;
+      }
+
+      munmap(src, size);
+
+      for (c = 0; c < 256; c++) {
+         if (bytes[c] == 0) continue;
+
+         snprintf(name, sizeof(name), "%s_%d", path, (int) c);
+
+         if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+            continue;
+
+         for (i = pos[c] - bytes[c]; i < pos[c]; i += j) {
+            ssize_t w = write(fd, dst + i, pos[c] - i);
+            if (w <= 0) break;
+            j = w;
+         }
+
+         close(fd);
+
+         av_push(ret, newSVuv(c));
+         av_push(ret, newSVuv(bytes[c]));
+         av_push(ret, newSVuv(lines[c]));
+      }
+
+      free((void *) dst);
+      unlink(path);
+
+      return sv_2mortal(ret);
+   }
+
+   // Create the output file at its final size, so that workers can write
+   // their buckets at any offset.
+
+   int c_fallocate(char *path, size_t size)
+   {
+      int fd, ret = 0;
+
+      if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+         return -1;
+
+      if (posix_fallocate(fd, 0, size) != 0 && ftruncate(fd, size) != 0)
+         ret = -1;
+
+      close(fd);
+      return ret;
+   }
+
+   // Copy the file at path to out_fd. The sorted buckets live in /dev/shm,
+   // so sendfile moves the pages straight from the page cache to the output
+   // without passing through user space. Falls back to read/write when the
+   // descriptor does not support it.
+
+   int c_output(char *path, int out_fd)
+   {
+      char buf[65536];
+      struct stat st;
+      off_t off = 0;
+      ssize_t r, w;
+      int fd;
+
+      if ((fd = open(path, O_RDONLY)) < 0)
+         return -1;
+
+   #ifdef __linux__
+      if (fstat(fd, &st) == 0) {
+         while (off < st.st_size) {
+            if ((r = sendfile(out_fd, fd, &off, st.st_size - off)) <= 0)
+               break;
+         }
+         if (off >= st.st_size) {
+            close(fd); return 0;
+         }
+         lseek(fd, off, SEEK_SET);
+      }
+   #endif
+
+      while ((r = read(fd, buf, sizeof(buf))) > 0) {
+         for (off = 0; off < r; off += w) {
+            if ((w = write(out_fd, buf + off, r - off)) <= 0) {
+               close(fd); return -1;
+            }
+         }
+      }
+
+      close(fd);
+      return 0;
+   }
+
+   // Copy the file at path into out_path, starting at offset.
+
+   int c_output_at(char *path, char *out_path, size_t offset)
+   {
+      int fd, ret;
+
+      if ((fd = open(out_path, O_WRONLY)) < 0)
+         return -1;
+
+      if (lseek(fd, offset, SEEK_SET) != (off_t) offset) {
+         close(fd); return -1;
+      }
+
+      ret = c_output(path, fd);
+      close(fd);
+
+      return ret;
+   }
+
+
+MODULE = dbg1_13cc  PACKAGE = main  
+
+PROTOTYPES: DISABLE
+
+
+void
+c_shared_init ()
+        PREINIT:
+        I32* temp;
+        PPCODE:
+        temp = PL_markstack_ptr++;
+        c_shared_init();
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+
+size_t
+c_bucket_lines (bucket)
+	size_t	bucket
+
+void
+c_set_fd (bucket, fd)
+	size_t	bucket
+	int	fd
+        PREINIT:
+        I32* temp;
+        PPCODE:
+        temp = PL_markstack_ptr++;
+        c_set_fd(bucket, fd);
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+
+void
+c_mem_acquire (need, budget)
+	size_t	need
+	size_t	budget
+        PREINIT:
+        I32* temp;
+        PPCODE:
+        temp = PL_markstack_ptr++;
+        c_mem_acquire(need, budget);
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+
+void
+c_mem_release (need)
+	size_t	need
+        PREINIT:
+        I32* temp;
+        PPCODE:
+        temp = PL_markstack_ptr++;
+        c_mem_release(need);
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+
+double
+c_phys_mem ()
+
+void
+c_init (chunk_size)
+	size_t	chunk_size
+        PREINIT:
+        I32* temp;
+        PPCODE:
+        temp = PL_markstack_ptr++;
+        c_init(chunk_size);
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+
+void
+c_end ()
+        PREINIT:
+        I32* temp;
+        PPCODE:
+        temp = PL_markstack_ptr++;
+        c_end();
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+
+void
+c_part (size, buffer)
+	size_t	size
+	char *	buffer
+        PREINIT:
+        I32* temp;
+        PPCODE:
+        temp = PL_markstack_ptr++;
+        c_part(size, buffer);
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+
+void
+c_part_range (path, lo, hi)
+	char *	path
+	size_t	lo
+	size_t	hi
+        PREINIT:
+        I32* temp;
+        PPCODE:
+        temp = PL_markstack_ptr++;
+        c_part_range(path, lo, hi);
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+
+AV *
+c_split (path)
+	char *	path
+
+int
+c_fallocate (path, size)
+	char *	path
+	size_t	size
+
+int
+c_output (path, out_fd)
+	char *	path
+	int	out_fd
+
+int
+c_output_at (path, out_path, offset)
+	char *	path
+	char *	out_path
+	size_t	offset
+
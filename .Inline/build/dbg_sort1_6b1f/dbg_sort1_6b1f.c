@@ -0,0 +1,856 @@
+/*
+ * This file was generated automatically by ExtUtils::ParseXS version 3.45 from the
+ * contents of dbg_sort1_6b1f.xs. Do not edit this file, edit dbg_sort1_6b1f.xs instead.
+ *
+ *    ANY CHANGES MADE HERE WILL BE LOST!
+ *
+ */
+
+#line 1 "dbg_sort1_6b1f.xs"
+#include "EXTERN.h"
+#include "perl.h"
+#include "XSUB.h"
+#include "INLINE.h"
+
+   #include <stdlib.h>
+   #include <string.h>
+   #include <fcntl.h>
+   #include <unistd.h>
+   #include <sys/stat.h>
+   #include <sys/mman.h>
+   #ifdef __linux__
+   #include <sys/sendfile.h>
+   #endif
+
+   // This is not thread-safe. MCE is configured to not use threads.
+
+   size_t m[127], s[127], bucket_size;
+   char **a[127];
+
+   // Bucket data is appended without locks. Each chunk reserves a range at
+   // the end of the bucket file with an atomic add on the shared end offset,
+   // then writes its bytes there with pwrite. The end offsets are mapped
+   // before MCE spawns the workers, which inherit the mapping.
+
+   size_t *bucket_end, *bucket_lines, l[127];
+   int bucket_fd[127];
+
+   void c_shared_init()
+   {
+      bucket_end = (size_t *) mmap(NULL, sizeof(size_t) * 127 * 2,
+         PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+
+      memset(bucket_end, 0, sizeof(size_t) * 127 * 2);
+      bucket_lines = bucket_end + 127;
+   }
+
+   size_t c_bucket_lines(size_t bucket)
+   {
+      return bucket_lines[bucket];
+   }
+
+   void c_set_fd(size_t bucket, int fd)
+   {
+      bucket_fd[bucket] = fd;
+   }
+
+   static void write_bucket(size_t bucket)
+   {
+      size_t len = s[bucket], off;
+      char *p = (char *) a[bucket];
+      ssize_t w;
+
+      off = __sync_fetch_and_add(&bucket_end[bucket], len);
+      __sync_fetch_and_add(&bucket_lines[bucket], l[bucket]);
+
+      for (; len > 0; p += w, off += w, len -= w) {
+         if ((w = pwrite(bucket_fd[bucket], p, len, off)) <= 0)
+            break;
+      }
+
+      s[bucket] = l[bucket] = 0;
+   }
+
+   void c_init(size_t chunk_size)
+   {
+      size_t bucket;
+
+      for (bucket = 32; bucket < 127; bucket++)
+         m[bucket] = s[bucket] = l[bucket] = 0;
+
+      bucket_size = chunk_size + 256;
+   }
+
+   void c_end()
+   {
+      size_t bucket;
+
+      for (bucket = 32; bucket < 127; bucket++) {
+         if (m[bucket]) {
+            free((void *) a[bucket]);
+            m[bucket] = 0;
+         }
+      }
+   }
+
+   // The bucket of a line is its first character, or 32 for characters
+   // below a space.
+
+   static size_t bucket_of(char *line)
+   {
+      size_t bucket = line[0];
+
+      return (bucket < 32) ? 32 : bucket;
+   }
+
+   void c_part(size_t size, char *buffer)
+   {
+      size_t start_pos = 0, i, len, bucket;
+      char *p;
+
+      for (i = 0; i < size; i++) {
+         if (buffer[i] == '\n') {
+            bucket = bucket_of(buffer + start_pos);
+
+            if (! m[bucket]) {
+               a[bucket] = (char *) malloc(bucket_size);
+               m[bucket] = bucket_size;
+            }
+
+            p = a[bucket];  len = i - start_pos + 1;
+            memcpy(p + s[bucket], buffer + start_pos, sizeof(char) * len);
+            s[bucket] += len;  start_pos = i + 1;  l[bucket]++;
+         }
+      }
+
+      for (bucket = 32; bucket < 127; bucket++) {
+         if (s[bucket]) write_bucket(bucket);
+      }
+   }
+
+   // Stage A for --index. Partitions the lines starting in [lo, hi) of the
+   // input, read from a private mapping, appending to each line a NUL and
+   // its offset in the input as 16 hex digits. The sort binaries write the
+   // offsets into the index (--index-tags) and stop at the NUL otherwise.
+
+   #define TAG_LEN 17
+
+   void c_part_range(char *path, size_t lo, size_t hi)
+   {
+      static const char hex[] = "0123456789abcdef";
+      size_t size, i, j, k, len, bucket;
+      char *src, *p, *q;
+      struct stat st;
+      int fd;
+
+      if ((fd = open(path, O_RDONLY)) < 0)
+         return;
+
+      if (fstat(fd, &st) != 0 || (size = st.st_size) == 0) {
+         close(fd); return;
+      }
+
+      src = (char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+
+      if (src == MAP_FAILED)
+         return;
+
+      if (hi > size) hi = size;
+
+      // The first line starting at or after lo
+      if (lo == 0) {
+         i = 0;
+      } else {
+         p = (char *) memchr(src + lo - 1, '\n', size - lo + 1);
+         i = (p != NULL) ? p - src + 1 : size;
+      }
+
+      for (; i < hi; i = j) {
+         if ((p = (char *) memchr(src + i, '\n', size - i)) == NULL)
+            break;
+
+         j = p - src + 1;  len = j - i - 1;
+         bucket = bucket_of(src + i);
+
+         if (s[bucket] + len + TAG_LEN > m[bucket]) {
+            if (s[bucket]) write_bucket(bucket);
+
+            if (len + TAG_LEN > m[bucket]) {
+               k = (len + TAG_LEN > bucket_size) ? len + TAG_LEN : bucket_size;
+               a[bucket] = (char **) ((m[bucket])
+                  ? realloc(a[bucket], k) : malloc(k));
+               m[bucket] = k;
+            }
+         }
+
+         q = (char *) a[bucket] + s[bucket];
+         memcpy(q, src + i, len);  q += len;  *q++ = '\0';
+
+         for (k = 0; k < 16; k++)
+            q[k] = hex[(i >> (60 - 4 * k)) & 15];
+
+         q[16] = '\n';
+         s[bucket] += len + TAG_LEN;  l[bucket]++;
+      }
+
+      for (bucket = 32; bucket < 127; bucket++) {
+         if (s[bucket]) write_bucket(bucket);
+      }
+
+      munmap(src, size);
+   }
+
+   // Split a bucket file by the second character of each line into files
+   // named path_C, C being the character code or 0 for one-character lines.
+   // Returns the sub-bucket, bytes and lines of each file written. The
+   // bucket file is removed afterwards.
+
+   AV * c_split(char *path)
+   {
+      AV *ret = newAV();
+
+      size_t bytes[256], lines[256], pos[256], size, i, j, c;
+      char *src, *dst, *p, name[4096];
+      struct stat st;
+      int fd;
+
+      if ((fd = open(path, O_RDONLY)) < 0)
+         return sv_2mortal(ret);
+
+      if (fstat(fd, &st) != 0 || (size = st.st_size) == 0) {
+         close(fd); return sv_2mortal(ret);
+      }
+
+      src = (char *) mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+      close(fd);
+
+      if (src == MAP_FAILED || (dst = (char *) malloc(size)) == NULL) {
+         if (src != MAP_FAILED) munmap(src, size);
+         return sv_2mortal(ret);
+      }
+
+      memset(bytes, 0, sizeof(bytes));
+      memset(lines, 0, sizeof(lines));
+
+      for (i = 0; i < size; i = j) {
+         p = (char *) memchr(src + i, '\n', size - i);
+         j = (p != NULL) ? p - src + 1 : size;
+         c = (j - i > 2) ? (unsigned char) src[i + 1] : 0;
+         bytes[c] += j - i; lines[c]++;
+      }
+
+      for (c = 0, j = 0; c < 256; c++) {
+         pos[c] = j; j += bytes[c];
+      }
+
+      for (i = 0; i < size; i = j) {
+         p = (char *) memchr(src + i, '\n', size - i);
+         j = (p != NULL) ? p - src + 1 : size;
+         c = (j - i > 2) ? (unsigned char) src[i + 1] : 0;
+         memcpy(dst + pos[c], src + i, j - i); pos[c] += j - i;
+      }
+
+      munmap(src, size);
+
+      for (c = 0; c < 256; c++) {
+         if (bytes[c] == 0) continue;
+
+         snprintf(name, sizeof(name), "%s_%d", path, (int) c);
+
+         if ((fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0600)) < 0)
+            continue;
+
+         for (i = pos[c] - bytes[c]; i < pos[c]; i += j) {
+            ssize_t w = write(fd, dst + i, pos[c] - i);
+            if (w <= 0) break;
+            j = w;
+         }
+
+         close(fd);
+
+         av_push(ret, newSVuv(c));
+         av_push(ret, newSVuv(bytes[c]));
+         av_push(ret, newSVuv(lines[c]));
+      }
+
+      free((void *) dst);
+      unlink(path);
+
+      return sv_2mortal(ret);
+   }
+
+   // Create the output file at its final size, so that workers can write
+   // their buckets at any offset.
+
+   int c_fallocate(char *path, size_t size)
+   {
+      int fd, ret = 0;
+
+      if ((fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666)) < 0)
+         return -1;
+
+      if (posix_fallocate(fd, 0, size) != 0 && ftruncate(fd, size) != 0)
+         ret = -1;
+
+      close(fd);
+      return ret;
+   }
+
+   // Copy the file at path to out_fd. The sorted buckets live in /dev/shm,
+   // so sendfile moves the pages straight from the page cache to the output
+   // without passing through user space. Falls back to read/write when the
+   // descriptor does not support it.
+
+   int c_output(char *path, int out_fd)
+   {
+      char buf[65536];
+      struct stat st;
+      off_t off = 0;
+      ssize_t r, w;
+      int fd;
+
+      if ((fd = open(path, O_RDONLY)) < 0)
+         return -1;
+
+   #ifdef __linux__
+      if (fstat(fd, &st) == 0) {
+         while (off < st.st_size) {
+            if ((r = sendfile(out_fd, fd, &off, st.st_size - off)) <= 0)
+               break;
+         }
+         if (off >= st.st_size) {
+            close(fd); return 0;
+         }
+         lseek(fd, off, SEEK_SET);
+      }
+   #endif
+
+      while ((r = read(fd, buf, sizeof(buf))) > 0) {
+         for (off = 0; off < r; off += w) {
+            if ((w = write(out_fd, buf + off, r - off)) <= 0) {
+               close(fd); return -1;
+            }
+         }
+      }
+
+      close(fd);
+      return 0;
+   }
+
+   // Copy the file at path into out_path, starting at offset.
+
+   int c_output_at(char *path, char *out_path, size_t offset)
+   {
+      int fd, ret;
+
+      if ((fd = open(out_path, O_WRONLY)) < 0)
+         return -1;
+
+      if (lseek(fd, offset, SEEK_SET) != (off_t) offset) {
+         close(fd); return -1;
+      }
+
+      ret = c_output(path, fd);
+      close(fd);
+
+      return ret;
+   }
+
+
+#line 362 "dbg_sort1_6b1f.c"
+#ifndef PERL_UNUSED_VAR
+#  define PERL_UNUSED_VAR(var) if (0) var = var
+#endif
+
+#ifndef dVAR
+#  define dVAR		dNOOP
+#endif
+
+
+/* This stuff is not part of the API! You have been warned. */
+#ifndef PERL_VERSION_DECIMAL
+#  define PERL_VERSION_DECIMAL(r,v,s) (r*1000000 + v*1000 + s)
+#endif
+#ifndef PERL_DECIMAL_VERSION
+#  define PERL_DECIMAL_VERSION \
+	  PERL_VERSION_DECIMAL(PERL_REVISION,PERL_VERSION,PERL_SUBVERSION)
+#endif
+#ifndef PERL_VERSION_GE
+#  define PERL_VERSION_GE(r,v,s) \
+	  (PERL_DECIMAL_VERSION >= PERL_VERSION_DECIMAL(r,v,s))
+#endif
+#ifndef PERL_VERSION_LE
+#  define PERL_VERSION_LE(r,v,s) \
+	  (PERL_DECIMAL_VERSION <= PERL_VERSION_DECIMAL(r,v,s))
+#endif
+
+/* XS_INTERNAL is the explicit static-linkage variant of the default
+ * XS macro.
+ *
+ * XS_EXTERNAL is the same as XS_INTERNAL except it does not include
+ * "STATIC", ie. it exports XSUB symbols. You probably don't want that
+ * for anything but the BOOT XSUB.
+ *
+ * See XSUB.h in core!
+ */
+
+
+/* TODO: This might be compatible further back than 5.10.0. */
+#if PERL_VERSION_GE(5, 10, 0) && PERL_VERSION_LE(5, 15, 1)
+#  undef XS_EXTERNAL
+#  undef XS_INTERNAL
+#  if defined(__CYGWIN__) && defined(USE_DYNAMIC_LOADING)
+#    define XS_EXTERNAL(name) __declspec(dllexport) XSPROTO(name)
+#    define XS_INTERNAL(name) STATIC XSPROTO(name)
+#  endif
+#  if defined(__SYMBIAN32__)
+#    define XS_EXTERNAL(name) EXPORT_C XSPROTO(name)
+#    define XS_INTERNAL(name) EXPORT_C STATIC XSPROTO(name)
+#  endif
+#  ifndef XS_EXTERNAL
+#    if defined(HASATTRIBUTE_UNUSED) && !defined(__cplusplus)
+#      define XS_EXTERNAL(name) void name(pTHX_ CV* cv __attribute__unused__)
+#      define XS_INTERNAL(name) STATIC void name(pTHX_ CV* cv __attribute__unused__)
+#    else
+#      ifdef __cplusplus
+#        define XS_EXTERNAL(name) extern "C" XSPROTO(name)
+#        define XS_INTERNAL(name) static XSPROTO(name)
+#      else
+#        define XS_EXTERNAL(name) XSPROTO(name)
+#        define XS_INTERNAL(name) STATIC XSPROTO(name)
+#      endif
+#    endif
+#  endif
+#endif
+
+/* perl >= 5.10.0 && perl <= 5.15.1 */
+
+
+/* The XS_EXTERNAL macro is used for functions that must not be static
+ * like the boot XSUB of a module. If perl didn't have an XS_EXTERNAL
+ * macro defined, the best we can do is assume XS is the same.
+ * Dito for XS_INTERNAL.
+ */
+#ifndef XS_EXTERNAL
+#  define XS_EXTERNAL(name) XS(name)
+#endif
+#ifndef XS_INTERNAL
+#  define XS_INTERNAL(name) XS(name)
+#endif
+
+/* Now, finally, after all this mess, we want an ExtUtils::ParseXS
+ * internal macro that we're free to redefine for varying linkage due
+ * to the EXPORT_XSUB_SYMBOLS XS keyword. This is internal, use
+ * XS_EXTERNAL(name) or XS_INTERNAL(name) in your code if you need to!
+ */
+
+#undef XS_EUPXS
+#if defined(PERL_EUPXS_ALWAYS_EXPORT)
+#  define XS_EUPXS(name) XS_EXTERNAL(name)
+#else
+   /* default to internal */
+#  define XS_EUPXS(name) XS_INTERNAL(name)
+#endif
+
+#ifndef PERL_ARGS_ASSERT_CROAK_XS_USAGE
+#define PERL_ARGS_ASSERT_CROAK_XS_USAGE assert(cv); assert(params)
+
+/* prototype to pass -Wmissing-prototypes */
+STATIC void
+S_croak_xs_usage(const CV *const cv, const char *const params);
+
+STATIC void
+S_croak_xs_usage(const CV *const cv, const char *const params)
+{
+    const GV *const gv = CvGV(cv);
+
+    PERL_ARGS_ASSERT_CROAK_XS_USAGE;
+
+    if (gv) {
+        const char *const gvname = GvNAME(gv);
+        const HV *const stash = GvSTASH(gv);
+        const char *const hvname = stash ? HvNAME(stash) : NULL;
+
+        if (hvname)
+	    Perl_croak_nocontext("Usage: %s::%s(%s)", hvname, gvname, params);
+        else
+	    Perl_croak_nocontext("Usage: %s(%s)", gvname, params);
+    } else {
+        /* Pants. I don't think that it should be possible to get here. */
+	Perl_croak_nocontext("Usage: CODE(0x%" UVxf ")(%s)", PTR2UV(cv), params);
+    }
+}
+#undef  PERL_ARGS_ASSERT_CROAK_XS_USAGE
+
+#define croak_xs_usage        S_croak_xs_usage
+
+#endif
+
+/* NOTE: the prototype of newXSproto() is different in versions of perls,
+ * so we define a portable version of newXSproto()
+ */
+#ifdef newXS_flags
+#define newXSproto_portable(name, c_impl, file, proto) newXS_flags(name, c_impl, file, proto, 0)
+#else
+#define newXSproto_portable(name, c_impl, file, proto) (PL_Sv=(SV*)newXS(name, c_impl, file), sv_setpv(PL_Sv, proto), (CV*)PL_Sv)
+#endif /* !defined(newXS_flags) */
+
+#if PERL_VERSION_LE(5, 21, 5)
+#  define newXS_deffile(a,b) Perl_newXS(aTHX_ a,b,file)
+#else
+#  define newXS_deffile(a,b) Perl_newXS_deffile(aTHX_ a,b)
+#endif
+
+#line 506 "dbg_sort1_6b1f.c"
+
+XS_EUPXS(XS_main_c_shared_init); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_main_c_shared_init)
+{
+    dVAR; dXSARGS;
+    if (items != 0)
+       croak_xs_usage(cv,  "");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+#line 360 "dbg_sort1_6b1f.xs"
+        I32* temp;
+#line 519 "dbg_sort1_6b1f.c"
+#line 362 "dbg_sort1_6b1f.xs"
+        temp = PL_markstack_ptr++;
+        c_shared_init();
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+#line 530 "dbg_sort1_6b1f.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_main_c_bucket_lines); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_main_c_bucket_lines)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "bucket");
+    {
+	size_t	bucket = (size_t)SvUV(ST(0))
+;
+	size_t	RETVAL;
+	dXSTARG;
+
+	RETVAL = c_bucket_lines(bucket);
+	XSprePUSH;
+	PUSHu((UV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_main_c_set_fd); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_main_c_set_fd)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "bucket, fd");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	size_t	bucket = (size_t)SvUV(ST(0))
+;
+	int	fd = (int)SvIV(ST(1))
+;
+#line 381 "dbg_sort1_6b1f.xs"
+        I32* temp;
+#line 572 "dbg_sort1_6b1f.c"
+#line 383 "dbg_sort1_6b1f.xs"
+        temp = PL_markstack_ptr++;
+        c_set_fd(bucket, fd);
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+#line 583 "dbg_sort1_6b1f.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_main_c_init); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_main_c_init)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "chunk_size");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	size_t	chunk_size = (size_t)SvUV(ST(0))
+;
+#line 397 "dbg_sort1_6b1f.xs"
+        I32* temp;
+#line 603 "dbg_sort1_6b1f.c"
+#line 399 "dbg_sort1_6b1f.xs"
+        temp = PL_markstack_ptr++;
+        c_init(chunk_size);
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+#line 614 "dbg_sort1_6b1f.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_main_c_end); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_main_c_end)
+{
+    dVAR; dXSARGS;
+    if (items != 0)
+       croak_xs_usage(cv,  "");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+#line 412 "dbg_sort1_6b1f.xs"
+        I32* temp;
+#line 632 "dbg_sort1_6b1f.c"
+#line 414 "dbg_sort1_6b1f.xs"
+        temp = PL_markstack_ptr++;
+        c_end();
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+#line 643 "dbg_sort1_6b1f.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_main_c_part); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_main_c_part)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "size, buffer");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	size_t	size = (size_t)SvUV(ST(0))
+;
+	char *	buffer = (char *)SvPV_nolen(ST(1))
+;
+#line 429 "dbg_sort1_6b1f.xs"
+        I32* temp;
+#line 665 "dbg_sort1_6b1f.c"
+#line 431 "dbg_sort1_6b1f.xs"
+        temp = PL_markstack_ptr++;
+        c_part(size, buffer);
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+#line 676 "dbg_sort1_6b1f.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_main_c_part_range); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_main_c_part_range)
+{
+    dVAR; dXSARGS;
+    if (items != 3)
+       croak_xs_usage(cv,  "path, lo, hi");
+    PERL_UNUSED_VAR(ax); /* -Wall */
+    SP -= items;
+    {
+	char *	path = (char *)SvPV_nolen(ST(0))
+;
+	size_t	lo = (size_t)SvUV(ST(1))
+;
+	size_t	hi = (size_t)SvUV(ST(2))
+;
+#line 447 "dbg_sort1_6b1f.xs"
+        I32* temp;
+#line 700 "dbg_sort1_6b1f.c"
+#line 449 "dbg_sort1_6b1f.xs"
+        temp = PL_markstack_ptr++;
+        c_part_range(path, lo, hi);
+        if (PL_markstack_ptr != temp) {
+          /* truly void, because dXSARGS not invoked */
+          PL_markstack_ptr = temp;
+          XSRETURN_EMPTY; /* return empty stack */
+        }
+        /* must have used dXSARGS; list context implied */
+        return; /* assume stack size is correct */
+#line 711 "dbg_sort1_6b1f.c"
+	PUTBACK;
+	return;
+    }
+}
+
+
+XS_EUPXS(XS_main_c_split); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_main_c_split)
+{
+    dVAR; dXSARGS;
+    if (items != 1)
+       croak_xs_usage(cv,  "path");
+    {
+	char *	path = (char *)SvPV_nolen(ST(0))
+;
+	AV *	RETVAL;
+
+	RETVAL = c_split(path);
+	{
+	    SV * RETVALSV;
+	    RETVALSV = newRV((SV*)RETVAL);
+	    RETVALSV = sv_2mortal(RETVALSV);
+	    ST(0) = RETVALSV;
+	}
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_main_c_fallocate); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_main_c_fallocate)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "path, size");
+    {
+	char *	path = (char *)SvPV_nolen(ST(0))
+;
+	size_t	size = (size_t)SvUV(ST(1))
+;
+	int	RETVAL;
+	dXSTARG;
+
+	RETVAL = c_fallocate(path, size);
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_main_c_output); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_main_c_output)
+{
+    dVAR; dXSARGS;
+    if (items != 2)
+       croak_xs_usage(cv,  "path, out_fd");
+    {
+	char *	path = (char *)SvPV_nolen(ST(0))
+;
+	int	out_fd = (int)SvIV(ST(1))
+;
+	int	RETVAL;
+	dXSTARG;
+
+	RETVAL = c_output(path, out_fd);
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+
+XS_EUPXS(XS_main_c_output_at); /* prototype to pass -Wmissing-prototypes */
+XS_EUPXS(XS_main_c_output_at)
+{
+    dVAR; dXSARGS;
+    if (items != 3)
+       croak_xs_usage(cv,  "path, out_path, offset");
+    {
+	char *	path = (char *)SvPV_nolen(ST(0))
+;
+	char *	out_path = (char *)SvPV_nolen(ST(1))
+;
+	size_t	offset = (size_t)SvUV(ST(2))
+;
+	int	RETVAL;
+	dXSTARG;
+
+	RETVAL = c_output_at(path, out_path, offset);
+	XSprePUSH;
+	PUSHi((IV)RETVAL);
+    }
+    XSRETURN(1);
+}
+
+#ifdef __cplusplus
+extern "C"
+#endif
+XS_EXTERNAL(boot_dbg_sort1_6b1f); /* prototype to pass -Wmissing-prototypes */
+XS_EXTERNAL(boot_dbg_sort1_6b1f)
+{
+#if PERL_VERSION_LE(5, 21, 5)
+    dVAR; dXSARGS;
+#else
+    dVAR; dXSBOOTARGSXSAPIVERCHK;
+#endif
+#if PERL_VERSION_LE(5, 8, 999) /* PERL_VERSION_LT is 5.33+ */
+    char* file = __FILE__;
+#else
+    const char* file = __FILE__;
+#endif
+
+    PERL_UNUSED_VAR(file);
+
+    PERL_UNUSED_VAR(cv); /* -W */
+    PERL_UNUSED_VAR(items); /* -W */
+#if PERL_VERSION_LE(5, 21, 5)
+    XS_VERSION_BOOTCHECK;
+#  ifdef XS_APIVERSION_BOOTCHECK
+    XS_APIVERSION_BOOTCHECK;
+#  endif
+#endif
+
+        newXS_deffile("main::c_shared_init", XS_main_c_shared_init);
+        newXS_deffile("main::c_bucket_lines", XS_main_c_bucket_lines);
+        newXS_deffile("main::c_set_fd", XS_main_c_set_fd);
+        newXS_deffile("main::c_init", XS_main_c_init);
+        newXS_deffile("main::c_end", XS_main_c_end);
+        newXS_deffile("main::c_part", XS_main_c_part);
+        newXS_deffile("main::c_part_range", XS_main_c_part_range);
+        newXS_deffile("main::c_split", XS_main_c_split);
+        newXS_deffile("main::c_fallocate", XS_main_c_fallocate);
+        newXS_deffile("main::c_output", XS_main_c_output);
+        newXS_deffile("main::c_output_at", XS_main_c_output_at);
+#if PERL_VERSION_LE(5, 21, 5)
+#  if PERL_VERSION_GE(5, 9, 0)
+    if (PL_unitcheckav)
+        call_list(PL_scopestack_ix, PL_unitcheckav);
+#  endif
+    XSRETURN_YES;
+#else
+    Perl_xs_boot_epilog(aTHX_ ax);
+#endif
+}
+
@@ -0,0 +1,22 @@
+md5 : 13cc476903edfa71c0dcbd622111eccb
+name : mce_sort1_13cc
+version : ""
+language : C
+language_id : C
+installed : 0
+date_compiled : Sun Oct 18 19:07:55 2026
+inline_version : 0.80
+ILSM : %
+    module : Inline::C
+    suffix : so
+    type : compiled
+Config : %
+    apiversion : ?
+    archname : x86_64-linux-gnu-thread-multi
+    cc : x86_64-linux-gnu-gcc
+    ccflags : -D_REENTRANT -D_GNU_SOURCE -DDEBIAN -fwrapv -fno-strict-aliasing -pipe -I/usr/local/include -D_LARGEFILE_SOURCE -D_FILE_OFFSET_BITS=64
+    ld : x86_64-linux-gnu-gcc
+    osname : linux
+    osvers : 4.19.0
+    so : so
+    version : 5.36.0
@@ -22,30 +22,37 @@
  */
 
 /*
- * usage: bs-mkqs [-r] file [-o sorted]
+ * usage: bs-mkqs [-r] [--threads=N] file [-o sorted]
  */
 
 #include "main.h"
 #include <string>
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <vector>
 
 namespace bs_mkqs {
 
 // ssort2 -- Faster Version of Multikey Quicksort
 
+template <typename S>
 static void
-vecswap2(char **a, char **b, int n)
+vecswap2(S *a, S *b, int n)
 {
    while (n-- > 0) {
-      char *t = *a;
+      S t = *a;
       *a++ = *b;
       *b++ = t;
    }
 }
 
-#define ptr2char(i) (*(*(i) + depth))
+#define ptr2char(i) (str_of(*(i))[depth])
 
-static char **
-med3func(char **a, char **b, char **c, size_t depth)
+template <typename S>
+static S *
+med3func(S *a, S *b, S *c, size_t depth)
 {
    int va, vb, vc;
 
@@ -60,33 +67,31 @@ med3func(char **a, char **b, char **c, size_t depth)
       : (vb > vc ? b : (va < vc ? a : c ) );
 }
 
+template <typename S>
 static void
-inssort(char **a, size_t n, size_t d)
+inssort(S *a, size_t n, size_t d)
 {
-   char **pi, **pj, *s, *t;
+   S *pi, *pj, tmp;
 
    for (pi = a + 1; --n > 0; pi++) {
       for (pj = pi; pj > a; pj--) {
-         for (s = *(pj - 1) + d, t = *pj + d; *s == *t && *s != 0; s++, t++) ;
+         if (scmp(str_of(*(pj - 1)) + d, str_of(*pj) + d) <= 0) break;
 
-         if (*s <= *t) break;
-
-         t = *(pj); *(pj) = *(pj - 1);
-         *(pj - 1) = t;
+         tmp = *(pj); *(pj) = *(pj - 1);
+         *(pj - 1) = tmp;
       }
    }
 }
 
-static void
-ssort2(char **a, size_t n, size_t depth)
+// Partition a[0..n-1] around the pseudomedian of the characters at depth,
+// leaving the <, = and > groups in that order. Returns their sizes.
+
+template <typename S>
+static inline void
+split3(S *a, size_t n, size_t depth, size_t *nlt, size_t *neq, size_t *ngt)
 {
    int d, r, partval;
-   char **pa, **pb, **pc, **pd, **pl, **pm, **pn, *t;
-
-   if (n < 20) {
-      inssort(a, n, depth);
-      return;
-   }
+   S *pa, *pb, *pc, *pd, *pl, *pm, *pn;
 
    pl = a;
    pm = a + (n/2);
@@ -124,14 +129,324 @@ ssort2(char **a, size_t n, size_t depth)
    r = std::min(pa-a, pb-pa);    vecswap2(a,  pb-r, r);
    r = std::min(pd-pc, pn-pd-1); vecswap2(pb, pn-r, r);
 
-   if ((r = pb-pa) > 1)
-      ssort2(a, r, depth);
+   *nlt = pb-pa;  *neq = pa-a + pn-pd-1;  *ngt = pd-pc;
+}
+
+template <typename S>
+static void
+ssort2(S *a, size_t n, size_t depth)
+{
+   size_t nlt, neq, ngt;
+
+   if (n < 20) {
+      inssort(a, n, depth);
+      return;
+   }
+
+   split3(a, n, depth, &nlt, &neq, &ngt);
+
+   if (nlt > 1)
+      ssort2(a, nlt, depth);
+
+   if (ptr2char(a + nlt) != 0)
+      ssort2(a + nlt, neq, depth+1);
+
+   if (ngt > 1)
+      ssort2(a + n-ngt, ngt, depth);
+}
+
+// ############################################################################
+
+// Parallel version. The top levels are partitioned by all threads together:
+// each counts its block against the pivot character, then scatters its
+// strings into a buffer at offsets given by the prefix sums of the counts,
+// and the buffer is copied back. The resulting groups are dealt out to
+// per-thread deques. Owners take the newest task from the back and idle
+// threads steal the oldest from the front of another deque. Groups of at
+// least PAR_CUTOFF strings are split once more and queued as new tasks,
+// smaller ones are sorted by ssort2 directly. A thread finding no task
+// sleeps until one is queued or the last task is done.
+
+#define PAR_CUTOFF 16384
+
+template <typename S>
+struct task {
+   S *a; size_t n, depth;
+};
+
+template <typename S>
+struct task_deque {
+   std::mutex mtx;
+   std::deque< task<S> > q;
+};
+
+template <typename S>
+struct pool {
+   int nthreads;
+   task_deque<S> *dq;
+   std::atomic<size_t> pending;   // tasks queued or running
+   std::atomic<size_t> queued;    // tasks queued
+   std::mutex mtx;
+   std::condition_variable cv;
+};
+
+template <typename S>
+static void
+push_task(pool<S> *p, int self, S *a, size_t n, size_t depth)
+{
+   task<S> t = { a, n, depth };
+
+   p->pending++;
+
+   {
+      std::lock_guard<std::mutex> lock(p->dq[self].mtx);
+      p->dq[self].q.push_back(t);
+   }
+
+   p->queued++;
+
+   // Taking the lock orders this with a sleeper testing its condition
+   std::lock_guard<std::mutex> lock(p->mtx);
+   p->cv.notify_one();
+}
+
+template <typename S>
+static bool
+take_task(pool<S> *p, int self, task<S> *t)
+{
+   for (int i = 0; i < p->nthreads; i++) {
+      task_deque<S> *dq = &p->dq[(self + i) % p->nthreads];
+      std::lock_guard<std::mutex> lock(dq->mtx);
+
+      if (dq->q.empty())
+         continue;
+
+      if (i == 0) {
+         *t = dq->q.back(); dq->q.pop_back();
+      } else {
+         *t = dq->q.front(); dq->q.pop_front();
+      }
+
+      p->queued--;
+      return true;
+   }
+
+   return false;
+}
+
+template <typename S>
+static void
+run_task(pool<S> *p, int self, task<S> *t)
+{
+   size_t nlt, neq, ngt, n = t->n, depth = t->depth;
+   S *a = t->a;
+
+   if (n < PAR_CUTOFF) {
+      ssort2(a, n, depth);
+      return;
+   }
+
+   split3(a, n, depth, &nlt, &neq, &ngt);
 
-   if (ptr2char(a + r) != 0)
-      ssort2(a + r, pa-a + pn-pd-1, depth+1);
+   if (nlt >= PAR_CUTOFF)
+      push_task(p, self, a, nlt, depth);
+   else if (nlt > 1)
+      ssort2(a, nlt, depth);
 
-   if ((r = pd-pc) > 1)
-      ssort2(a + n-r, r, depth);
+   if (ngt >= PAR_CUTOFF)
+      push_task(p, self, a + n-ngt, ngt, depth);
+   else if (ngt > 1)
+      ssort2(a + n-ngt, ngt, depth);
+
+   if (ptr2char(a + nlt) == 0)
+      ;
+   else if (neq >= PAR_CUTOFF)
+      push_task(p, self, a + nlt, neq, depth+1);
+   else
+      ssort2(a + nlt, neq, depth+1);
+}
+
+template <typename S>
+static void
+worker(pool<S> *p, int self)
+{
+   task<S> t;
+
+   for (;;) {
+      if (take_task(p, self, &t)) {
+         run_task(p, self, &t);
+
+         if (--p->pending == 0) {
+            std::lock_guard<std::mutex> lock(p->mtx);
+            p->cv.notify_all();
+         }
+      } else {
+         std::unique_lock<std::mutex> lock(p->mtx);
+
+         p->cv.wait(lock, [p]() { return p->queued > 0 || p->pending == 0; });
+
+         if (p->pending == 0)
+            return;
+      }
+   }
+}
+
+// Three-way partition of a[0..n-1] by nthreads threads, using tmp[0..n-1]
+
+template <typename S>
+static void
+par_split3(S *a, size_t n, size_t depth, S *tmp, int nthreads,
+           size_t *nlt, size_t *neq, size_t *ngt)
+{
+   std::vector<std::thread> threads;
+   std::vector<size_t> lt(nthreads), eq(nthreads), gt(nthreads);
+   size_t blk = (n + nthreads - 1) / nthreads;
+   int i, partval;
+
+   // Pivot character, pseudomedian of 9 as in split3
+   S *pl = a, *pm = a + (n/2), *pn = a + (n-1);
+   size_t d = n/8;
+
+   pl = med3func(pl, pl+d, pl+2*d, depth);
+   pm = med3func(pm-d, pm, pm+d, depth);
+   pn = med3func(pn-2*d, pn-d, pn, depth);
+   partval = ptr2char(med3func(pl, pm, pn, depth));
+
+   for (i = 0; i < nthreads; i++)
+      threads.push_back(std::thread([=, &lt, &eq, &gt]() {
+         S *p = a + std::min(n, i * blk), *e = a + std::min(n, (i+1) * blk);
+         size_t l = 0, q = 0, g = 0;
+         int r;
+
+         for (; p < e; p++) {
+            if ((r = ptr2char(p) - partval) < 0) l++;
+            else if (r == 0) q++;
+            else g++;
+         }
+
+         lt[i] = l; eq[i] = q; gt[i] = g;
+      }));
+
+   for (i = 0; i < nthreads; i++)
+      threads[i].join();
+
+   threads.clear();
+
+   *nlt = *neq = *ngt = 0;
+
+   for (i = 0; i < nthreads; i++) {
+      *nlt += lt[i]; *neq += eq[i]; *ngt += gt[i];
+   }
+
+   // Exclusive prefix sums give each block its place in every group
+   size_t ol = 0, oq = *nlt, og = *nlt + *neq, c;
+
+   for (i = 0; i < nthreads; i++) {
+      c = lt[i]; lt[i] = ol; ol += c;
+      c = eq[i]; eq[i] = oq; oq += c;
+      c = gt[i]; gt[i] = og; og += c;
+   }
+
+   for (i = 0; i < nthreads; i++)
+      threads.push_back(std::thread([=, &lt, &eq, &gt]() {
+         S *p = a + std::min(n, i * blk), *e = a + std::min(n, (i+1) * blk);
+         size_t l = lt[i], q = eq[i], g = gt[i];
+         int r;
+
+         for (; p < e; p++) {
+            if ((r = ptr2char(p) - partval) < 0) tmp[l++] = *p;
+            else if (r == 0) tmp[q++] = *p;
+            else tmp[g++] = *p;
+         }
+      }));
+
+   for (i = 0; i < nthreads; i++)
+      threads[i].join();
+
+   threads.clear();
+
+   for (i = 0; i < nthreads; i++)
+      threads.push_back(std::thread([=]() {
+         size_t lo = std::min(n, i * blk), hi = std::min(n, (i+1) * blk);
+         memcpy(a + lo, tmp + lo, (hi - lo) * sizeof(S));
+      }));
+
+   for (i = 0; i < nthreads; i++)
+      threads[i].join();
+}
+
+template <typename S>
+static void
+psort2(S *a, size_t n, int nthreads)
+{
+   std::vector< task<S> > top, rest;
+   size_t nlt, neq, ngt, top_min;
+   task<S> t = { a, n, 0 };
+   S *tmp;
+   int i;
+
+   if (nthreads < 2 || n < (size_t)PAR_CUTOFF * nthreads) {
+      ssort2(a, n, 0);
+      return;
+   }
+
+   if ((tmp = (S *)malloc(sizeof(S) * n)) == NULL) {
+      ssort2(a, n, 0);
+      return;
+   }
+
+   // Split groups larger than a thread's share with all threads
+   top_min = n / nthreads;
+   top.push_back(t);
+
+   while (!top.empty()) {
+      t = top.back(); top.pop_back();
+
+      par_split3(t.a, t.n, t.depth, tmp, nthreads, &nlt, &neq, &ngt);
+
+      task<S> parts[3] = {
+         { t.a, nlt, t.depth },
+         { t.a + nlt, neq, t.depth + 1 },
+         { t.a + t.n - ngt, ngt, t.depth }
+      };
+
+      // The = group is done when the pivot is the terminator
+      if (str_of(t.a[nlt])[t.depth] == 0)
+         parts[1].n = 0;
+
+      for (i = 0; i < 3; i++) {
+         if (parts[i].n >= top_min && parts[i].n >= PAR_CUTOFF)
+            top.push_back(parts[i]);
+         else if (parts[i].n > 1)
+            rest.push_back(parts[i]);
+      }
+   }
+
+   free((void *)tmp);
+
+   // Deal the remaining groups to the threads, largest first
+   std::sort(rest.begin(), rest.end(),
+      [](const task<S> &x, const task<S> &y) { return x.n > y.n; });
+
+   pool<S> p;
+   std::vector<std::thread> threads;
+
+   p.nthreads = nthreads;
+   p.dq = new task_deque<S>[nthreads];
+   p.pending = p.queued = rest.size();
+
+   for (i = 0; i < (int)rest.size(); i++)
+      p.dq[i % nthreads].q.push_back(rest[i]);
+
+   for (i = 1; i < nthreads; i++)
+      threads.push_back(std::thread(worker<S>, &p, i));
+
+   worker(&p, 0);
+
+   for (i = 0; i < nthreads - 1; i++)
+      threads[i].join();
+
+   delete [] p.dq;
 }
 
 #undef ptr2char
@@ -140,6 +455,11 @@ ssort2(char **a, size_t n, size_t depth)
 
 void sort_main(char **a, size_t n)
 {
-   bs_mkqs::ssort2(a, n, 0);
+   bs_mkqs::psort2(a, n, n_threads);
+}
+
+void sort_main(offset_t *a, size_t n)
+{
+   bs_mkqs::psort2(a, n, n_threads);
 }
 
@@ -8,75 +8,284 @@
  *
  * Mario Roy, 04/22/2014
  *
- * usage: binary [-r] file [-o sorted]
+ * usage: binary [-r] [--threads=N] file [-o sorted [--seek=offset]]
+ *               [--index=file [--index-lcp]]
+ *        binary [-r] [-f] [--locale=name] [--threads=N] file [-o sorted]
+ *        binary [-r] [--threads=N] --merge sorted... [-o merged]
+ *        binary [-r] [--threads=N] --delta=sorted file [-o merged]
+ *        binary [-r] --dist-rank=R --dist-peers=addr,... file [-o sorted]
+ *        binary [-r] [--threads=N] --record=size [--key=len] file
+ *               [-o sorted [--seek=offset]]
+ *        binary [--threads=N] --serve=path
+ *        binary --connect=path [options] file
+ *
+ *        --bm [--bm-out=file], --check, --no-output and --trace=file apply
+ *        to all forms
  */
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
 #include <fcntl.h>
 #include <getopt.h>
+#include <locale.h>
+#include <ctype.h>
+#include <signal.h>
+
+#include <chrono>
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <algorithm>
+#include <vector>
+
+#include "sidx.h"
+#include "dist.h"
+#include "serve.h"
+
+// Strings are referenced by pointer or, for inputs below 4 GiB, by a 32-bit
+// offset into space. The latter halves the size of the array the kernels
+// permute. Kernels are templates over the reference type and reach the
+// characters through str_of().
 
-#include <ctime>
+typedef uint32_t offset_t;
+
+char *space;
+
+static inline char *str_of(char *s) { return s; }
+static inline char *str_of(offset_t s) { return space + s; }
+
+template <typename S> inline S str_ref(char *s);
+template <> inline char *str_ref<char *>(char *s) { return s; }
+template <> inline offset_t str_ref<offset_t>(char *s) { return s - space; }
 
 extern void sort_main(char **a, size_t n);
+extern void sort_main(offset_t *a, size_t n);
+
+// Compare two null-terminated strings a word at a time, returning the
+// difference of the first differing bytes taken as unsigned. Loads may read
+// up to 7 bytes past the terminator; space is padded by SPACE_PAD for that.
 
-#define STOPWATCH_BEGIN() std::clock()
-#define STOPWATCH_END(start) (std::clock() - start) / (double) CLOCKS_PER_SEC;
+#define SPACE_PAD 16
+
+static inline int
+scmp(const char *s, const char *t)
+{
+   const uint64_t m = 0x7f7f7f7f7f7f7f7fULL;
+   uint64_t x, y, z;
+   int k;
+
+   // Most calls in the base cases differ at the first byte
+   if (*s != *t || *s == 0)
+      return (unsigned char)*s - (unsigned char)*t;
+
+   for (;; s += 8, t += 8) {
+      memcpy(&x, s, 8); memcpy(&y, t, 8);
+
+      // High bit set in each byte of z that differs or is zero in x
+      z = (x ^ y) | ~(((x & m) + m) | x | m);
+
+      if (z) {
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+         k = __builtin_ctzll(z) >> 3;
+#else
+         k = __builtin_clzll(z) >> 3;
+#endif
+         return (unsigned char)s[k] - (unsigned char)t[k];
+      }
+   }
+}
+
+// Elapsed time. CPU time would add up the threads of parallel kernels.
+#define STOPWATCH_BEGIN() std::chrono::steady_clock::now()
+#define STOPWATCH_END(start) std::chrono::duration<double>( \
+   std::chrono::steady_clock::now() - start).count();
 
 #define ALLOC_SIZE 8388608   // 8192K
+#define BLOCK_SIZE 4194304   // 4096K, read-ahead unit of the loader
 char output_buf[524288];     //  512K
 
+// Count of strings by their first character, gathered while loading. Points
+// to depth0_counts when it describes the array handed to sort_main, allowing
+// kernels to skip the counting pass at depth 0. NULL otherwise.
+
+size_t depth0_counts[256], *depth0_hist = NULL;
+
+// Number of threads for kernels that sort in parallel (--threads=N, where 0
+// means one per hardware thread). The others ignore it.
+
+int n_threads = 1;
+
+// Large buffers, such as the text of the file, are freed after each file.
+// The server (--serve) keeps them for the next job instead, with the pages
+// mapped already, growing them as needed. One slot per buffer.
+
+#define ARENA_TEXT    0
+#define ARENA_PAIRS   1          // and 2, the pair arrays of --record
+
+struct arena {
+   void *p;
+   size_t size;
+};
+
+arena arenas[3];
+int keep_arenas = 0;
+
+static void *
+arena_alloc(int slot, size_t size)
+{
+   arena *ar = &arenas[slot];
+
+   if (!keep_arenas)
+      return malloc(size);
+
+   if (size > ar->size) {
+      free(ar->p);
+      ar->size = ((ar->p = malloc(size)) != NULL) ? size : 0;
+   }
+
+   return ar->p;
+}
+
+static void
+arena_free(int slot, void *p)
+{
+   if (p != arenas[slot].p) free(p);
+}
+
+static double
+thread_cpu_time()
+{
+   struct timespec ts;
+
+   if (clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts) != 0)
+      return 0.0;
+
+   return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
 // ############################################################################
 
-static char **
-create_pointer_array(char *name, char *space, size_t size, size_t *np)
+// The file is read by a loader thread in BLOCK_SIZE pieces. The calling
+// thread follows behind, scanning for newlines, recording pointers and
+// counting first characters while the block is still warm in cache.
+
+struct loader {
+   int fd, done;
+   size_t size, loaded;
+   char *space;
+   std::mutex mtx;
+   std::condition_variable cv;
+};
+
+static void
+loader_thread(loader *ld)
+{
+   size_t pos = 0, len;
+   ssize_t r;
+
+   posix_fadvise(ld->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+   while (pos < ld->size) {
+      len = (ld->size - pos < BLOCK_SIZE) ? ld->size - pos : BLOCK_SIZE;
+
+      if ((r = read(ld->fd, ld->space + pos, len)) <= 0)
+         break;
+
+      pos += r;
+
+      std::lock_guard<std::mutex> lock(ld->mtx);
+      ld->loaded = pos;
+      ld->cv.notify_one();
+   }
+
+   std::lock_guard<std::mutex> lock(ld->mtx);
+   ld->loaded = pos; ld->done = 1;
+   ld->cv.notify_one();
+}
+
+template <typename S>
+static S *
+create_pointer_array(char *name, int fd, char *space, size_t *sizep,
+                     size_t *np, double *scan_t)
 {
-   size_t asize = ALLOC_SIZE, i, j, n = *np;
-   char *s, **a;
+   size_t asize = ALLOC_SIZE, j = 0, n = *np, loaded = 0;
+   char *s, *p, *end, *line;
+   int done = 0;
+   loader ld;
+   S *a, *b;
 
-   if ((a = (char **)malloc(sizeof(char **) * asize)) == NULL) {
+   if ((a = (S *)malloc(sizeof(S) * asize)) == NULL) {
       fprintf(stderr, "%s: Could not allocate ptr array\n", name);
-      free((void*)space); exit(1);
+      return NULL;
    }
 
-   s = space; a[0] = s;
+   memset(depth0_counts, 0, sizeof(depth0_counts));
+
+   ld.fd = fd; ld.done = 0; ld.size = *sizep; ld.loaded = 0; ld.space = space;
+   std::thread reader(loader_thread, &ld);
+
+   s = line = space; a[0] = str_ref<S>(s); *scan_t = 0.0;
+
+   while (!done) {
+      {
+         std::unique_lock<std::mutex> lock(ld.mtx);
+         while (ld.loaded == loaded && !ld.done) ld.cv.wait(lock);
+         loaded = ld.loaded; done = ld.done;
+      }
+
+      double t = thread_cpu_time();
+      end = space + loaded;
+
+      while (s < end) {
+         if (s == line)
+            depth0_counts[(*s == '\n') ? 0 : (unsigned char)*s]++;
 
-   for (i = 0, j = 0; i < size; i++) {
-      if (*s == '\n') {
+         if ((p = (char *)memchr(s, '\n', end - s)) == NULL) {
+            s = end; break;
+         }
          if (++j == ALLOC_SIZE) {
             asize += ALLOC_SIZE; j = 0;
 
-            if ((a = (char **)realloc(a, sizeof(char **) * asize)) == NULL) {
+            if ((b = (S *)realloc(a, sizeof(S) * asize)) == NULL) {
                fprintf(stderr, "%s: Could not reallocate ptr array\n", name);
-               free((void*)space); free((void*)a); exit(1);
+               reader.join(); free((void*)a); return NULL;
             }
+            a = b;
          }
-         *s++ = '\0'; a[++n] = s;
-
-      } else {
-         s++;
+         *p = '\0'; s = line = p + 1; a[++n] = str_ref<S>(s);
       }
+
+      *scan_t += thread_cpu_time() - t;
    }
 
+   reader.join();
+
+   // An unterminated last line is not part of the array
+   if (s != line) depth0_counts[(unsigned char)*line]--;
+
+   *sizep = loaded;
    *np = n;
    return a;
 }
 
 // ############################################################################
 
+template <typename S>
 static void
-output_ascending(char *name, int fd, char **a, size_t n)
+output_ascending(char *name, int fd, S *a, size_t n)
 {
    size_t i, j, size;
    char *s, *t = output_buf;
 
    for (i = 0, j = 0; i < n; i++) {
-      s = a[i];  while (*s) { *t++ = *s++; }  *t++ = '\n';
+      s = str_of(a[i]);  while (*s) { *t++ = *s++; }  *t++ = '\n';
 
       if (i % 2048 == 0) {
          j = t - output_buf;
@@ -96,14 +305,15 @@ output_ascending(char *name, int fd, char **a, size_t n)
    }
 }
 
+template <typename S>
 static void
-output_descending(char *name, int fd, char **a, size_t n)
+output_descending(char *name, int fd, S *a, size_t n)
 {
    size_t i, j, size;
    char *s, *t = output_buf;
 
    for (i = n - 1, j = 0; i >= 1; i--) {  // i is unsigned, a[0] is done below
-      s = a[i];  while (*s) { *t++ = *s++; }  *t++ = '\n';
+      s = str_of(a[i]);  while (*s) { *t++ = *s++; }  *t++ = '\n';
 
       if (i % 2048 == 0) {
          j = t - output_buf;
@@ -115,7 +325,7 @@ output_descending(char *name, int fd, char **a, size_t n)
       }
    }
 
-   s = a[0];  while (*s) { *t++ = *s++; }  *t++ = '\n';
+   s = str_of(a[0]);  while (*s) { *t++ = *s++; }  *t++ = '\n';
    j = t - output_buf;
 
    if ((size = write(fd, output_buf, j)) != j)
@@ -137,20 +347,169 @@ output_bm(FILE *fp, double load_t, double ptrary_t, double sort_t, double check_
       fprintf(fp, "PASS: 1\n");
 }
 
+template <typename S>
 static int
-check_array(char **a, size_t n)
+check_array(S *a, size_t n)
 {
    size_t i;
-   char *s1, *s2;
 
    for (i = 1; i < n; i++) {
-      for (s1 = a[i - 1], s2 = a[i]; *s1 == *s2 && *s1 != 0; s1++, s2++) ;
-      if (*s1 > *s2) return 1;
+      if (scmp(str_of(a[i - 1]), str_of(a[i])) > 0) return 1;
    }
 
    return 0;
 }
 
+// Sorted index output, see sidx.h. Entries hold the offsets of the lines in
+// the input file. The wrappers pass bucket files instead, whose lines carry
+// their offset in the original input after a NUL as 16 hex digits
+// (--index-tags), and write the entries of each bucket into a shared index
+// created beforehand, starting at entry --index-seek.
+
+#define TAG_LEN 17
+
+struct index_opts {
+   char *name;
+   int lcp_flag, tags_flag;
+   long long seek;
+};
+
+static inline uint64_t
+tag_of(char *s)
+{
+   uint64_t v = 0;
+   int i, c;
+
+   for (s += strlen(s) + 1, i = 0; i < 16; i++) {
+      c = s[i];
+      v = (v << 4) | ((c <= '9') ? c - '0' : c - 'a' + 10);
+   }
+
+   return v;
+}
+
+static inline uint32_t
+lcp_of(const char *s, const char *t)
+{
+   uint32_t k = 0;
+
+   while (s[k] == t[k] && s[k] != 0) k++;
+
+   return k;
+}
+
+static int
+pwrite_all(int fd, const char *buf, size_t len, off_t off)
+{
+   ssize_t w;
+
+   for (; len > 0; buf += w, len -= w, off += w) {
+      if ((w = pwrite(fd, buf, len, off)) <= 0)
+         return -1;
+   }
+
+   return 0;
+}
+
+template <typename S>
+static int
+output_index(char *name, S *a, size_t n, size_t size, int reverse_flag,
+             index_opts *ix)
+{
+   size_t i, j, k, per, w;
+   sidx_header h;
+   uint64_t first = 0, v;
+   off_t pos;
+   char *s, *prev = NULL;
+   int fd, ret = 0;
+
+   if (ix->seek < 0) {
+      memcpy(h.magic, SIDX_MAGIC, 8);
+      h.n = n; h.size = size; h.reserved = 0;
+      h.flags = (size > UINT32_MAX ? SIDX_WIDE : 0) |
+         (ix->lcp_flag ? SIDX_LCP : 0) | (reverse_flag ? SIDX_REVERSE : 0);
+
+      if ((fd = open(ix->name, O_RDWR | O_CREAT | O_TRUNC, 0666)) < 0 ||
+            pwrite_all(fd, (char *)&h, sizeof(h), 0) != 0) {
+         fprintf(stderr, "%s: Could not write to %s\n", name, ix->name);
+         if (fd >= 0) close(fd);
+         return -1;
+      }
+   }
+   else {
+      first = ix->seek;
+
+      if ((fd = open(ix->name, O_RDWR)) < 0 ||
+            pread(fd, &h, sizeof(h), 0) != sizeof(h) ||
+            memcmp(h.magic, SIDX_MAGIC, 8) != 0 || first + n > h.n) {
+         fprintf(stderr, "%s: %s is not a matching index\n", name, ix->name);
+         if (fd >= 0) close(fd);
+         return -1;
+      }
+   }
+
+   // Offsets, then LCPs, batched through output_buf
+   w = sidx_offset_size(h.flags); per = sizeof(output_buf) / w;
+   pos = sidx_offset_pos(&h, first);
+
+   for (i = 0; i < n && ret == 0; i += k, pos += k * w) {
+      k = (n - i < per) ? n - i : per;
+
+      for (j = 0; j < k; j++) {
+         s = str_of(a[reverse_flag ? n - 1 - (i + j) : i + j]);
+         v = ix->tags_flag ? tag_of(s) : (uint64_t)(s - space);
+
+         if (w == sizeof(uint64_t))
+            ((uint64_t *)output_buf)[j] = v;
+         else
+            ((uint32_t *)output_buf)[j] = v;
+      }
+
+      ret = pwrite_all(fd, output_buf, k * w, pos);
+   }
+
+   if (h.flags & SIDX_LCP) {
+      per = sizeof(output_buf) / sizeof(uint32_t);
+      pos = sidx_lcp_pos(&h, first);
+
+      for (i = 0; i < n && ret == 0; i += k, pos += k * sizeof(uint32_t)) {
+         k = (n - i < per) ? n - i : per;
+
+         for (j = 0; j < k; j++, prev = s) {
+            s = str_of(a[reverse_flag ? n - 1 - (i + j) : i + j]);
+            ((uint32_t *)output_buf)[j] = prev ? lcp_of(prev, s) : 0;
+         }
+
+         ret = pwrite_all(fd, output_buf, k * sizeof(uint32_t), pos);
+      }
+   }
+
+   if (ret != 0)
+      fprintf(stderr, "%s: Could not write to %s\n", name, ix->name);
+
+   close(fd);
+   return ret;
+}
+
+// Open the output for writing at offset, without truncating it. Used by the
+// parallel wrapper to place each bucket directly into the final file.
+
+static FILE *
+fopen_at(char *name, off_t offset)
+{
+   FILE *fp;
+   int fd;
+
+   if ((fd = open(name, O_WRONLY | O_CREAT, 0666)) < 0)
+      return NULL;
+
+   if (lseek(fd, offset, SEEK_SET) != offset || !(fp = fdopen(fd, "w"))) {
+      close(fd); return NULL;
+   }
+
+   return fp;
+}
+
 static off_t
 get_size(int fd)
 {
@@ -164,151 +523,2039 @@ get_size(int fd)
 
 // ############################################################################
 
-char *space, **a; size_t n;
+struct timings {
+   double load_t, ptrary_t, sort_t, check_t, save_t, free_t;   // duration
+   double start;                  // wall clock, seconds since the epoch
+   size_t bytes, lines;
+};
 
-int main(int argc, char *argv[])
+static double
+wall_time()
 {
-   double load_t, ptrary_t, sort_t, check_t, save_t, free_t;   // duration
-   std::clock_t start;
+   return std::chrono::duration<double>(
+      std::chrono::system_clock::now().time_since_epoch()).count();
+}
 
-   int fd, opt, reverse_flag = 0, check_status = 0;
-   int bm_flag = 0, bm_out_flag = 0, check_flag = 0, no_output_flag = 0;
-   char *bname = NULL, *fname = NULL, *oname = NULL;
-   FILE *bp, *fp, *op;
-   size_t size;
+// Chrome trace events (--trace=file), for chrome://tracing or Perfetto. The
+// phases are laid out one after the other from t->start; the pointer array
+// is built while loading, its share of the pass is shown as a phase of its
+// own. Alone, the binary writes a complete trace. Under the wrappers
+// (--trace-worker=N), it appends its events to the wrapper's trace, on the
+// track of worker N.
 
-   static struct option longopts[] = {
-      { "bm",         no_argument,        &bm_flag,         1 },
-      { "bm-out",     required_argument,  &bm_out_flag,     1 },
-      { "check",      no_argument,        &check_flag,      1 },
-      { "no-output",  no_argument,        &no_output_flag,  1 },
-      { NULL,         0,                  NULL,             0 }
+static void
+output_trace(char *name, char *tname, int worker, char *label, timings *t)
+{
+   const char *phase[] = {
+      "load", "ptrary", "sort", "check", "write", "free"
    };
-
-   // Parse command-line arguments
-   while ((opt = getopt_long(argc, argv, "ro:", longopts, NULL)) != -1) {
-      switch (opt) {
-         case 'r':
-            reverse_flag = 1;
-            break;
-         case 'o':
-            oname = optarg;
-            break;
-         case 0:
-            if (bm_out_flag) {
-               bm_out_flag = 0;
-               bname = optarg;
-            }
-            break;
-         default:
-            fprintf(stderr, "usage: %s [-r] file [-o output]\n", argv[0]);
-            exit(1);
-      }
+   double dur[] = {
+      t->load_t, t->ptrary_t, t->sort_t, t->check_t, t->save_t, t->free_t
+   };
+   double ts = t->start * 1e6;
+   char buf[4096], id[256];
+   int fd, i, j, len = 0;
+
+   // The label is a file name, quotes and backslashes are dropped
+   for (i = j = 0; label[i] && j < (int)sizeof(id) - 1; i++)
+      if (label[i] != '"' && label[i] != '\\') id[j++] = label[i];
+   id[j] = '\0';
+
+   if ((fd = open(tname, O_WRONLY | O_CREAT | O_APPEND |
+         (worker < 0 ? O_TRUNC : 0), 0666)) < 0) {
+      fprintf(stderr, "%s: Could not open %s for writing\n", name, tname);
+      return;
    }
 
-   if (optind >= argc) {
-      fprintf(stderr, "%s: missing file, ", argv[0]);
-      fprintf(stderr, "usage: %s [-r] file [-o sorted]\n", argv[0]);
-      exit(1);
+   if (worker < 0)
+      len += snprintf(buf + len, sizeof(buf) - len, "[\n");
+
+   for (i = 0; i < 6; i++) {
+      len += snprintf(buf + len, sizeof(buf) - len,
+         "{\"name\":\"%s\",\"cat\":\"bucket\",\"ph\":\"X\","
+         "\"ts\":%.0f,\"dur\":%.0f,\"pid\":1,\"tid\":%d,"
+         "\"args\":{\"file\":\"%s\",\"bytes\":%zu,\"lines\":%zu}}%s\n",
+         phase[i], ts, dur[i] * 1e6, worker < 0 ? 0 : worker, id,
+         t->bytes, t->lines, (worker < 0 && i == 5) ? "" : ",");
+
+      ts += dur[i] * 1e6;
    }
 
-   fname = argv[optind];
+   if (worker < 0)
+      len += snprintf(buf + len, sizeof(buf) - len, "]\n");
 
-   // =========================================================================
+   // One write, so that appends of concurrent binaries do not interleave
+   if (write(fd, buf, len) != len)
+      fprintf(stderr, "%s: Could not write to %s\n", name, tname);
 
-   // Error checking
-   if ((fp = fopen(fname, "r")) == NULL) {
-      fprintf(stderr, "%s: Could not open %s for reading\n", argv[0], fname);
-      exit(1);
-   }
-   if ((size = get_size(fileno(fp))) == -1) {
-      fprintf(stderr, "%s: %s is not a regular file\n", argv[0], fname);
-      fclose(fp); exit(1);
-   }
-   if (size == 0) {
-      fclose(fp); exit(0);
-   }
+   close(fd);
+}
+
+// ############################################################################
+
+// Collation (-f, --locale=name). Each line's key, folded to upper case with
+// -f and transformed with strxfrm for a locale other than C, is computed
+// once into a key arena, followed by a NUL and the line's reference. The
+// kernels sort the keys by bytes as usual. Lines with equal keys are then
+// ordered by strcoll and their bytes, the last resort of GNU sort.
+
+#define COLLATE_MIN 65536        // lines per thread building keys
+
+struct collate_opts {
+   int fold_flag, xfrm_flag;
+   unsigned char fold[256];
+};
+
+struct key_part {
+   char *buf;
+   size_t size, cap;
+   size_t counts[256];           // keys by their first byte
+};
+
+static inline char *text_of(char *, char *s) { return s; }
+static inline char *text_of(char *text, offset_t s) { return text + s; }
+
+// The reference to the line stored after the key
+template <typename S>
+static inline S
+line_ref(char *key)
+{
+   S s;
+
+   memcpy(&s, key + strlen(key) + 1, sizeof(S));
+   return s;
+}
+
+// Keys are escaped into bytes 1 to 127, the alphabet of the kernels. Bytes
+// below 0x7e are kept, the others become 0x7e or 0x7f followed by a byte
+// of 1 to 127, which preserves the order of keys. Returns the length.
+
+static inline size_t
+key_escape(char *dst, const char *src, size_t len)
+{
+   unsigned char c, *q = (unsigned char *)dst;
+   size_t i;
 
-   if (oname != NULL && no_output_flag == 0) {
-      if ((op = fopen(oname, "w")) == NULL) {
-         fprintf(stderr, "%s: Could not open %s for writing\n", argv[0], oname);
-         fclose(fp); exit(1);
+   for (i = 0; i < len; i++) {
+      if ((c = src[i]) < 0x7e) {
+         *q++ = c;
+      } else if (c < 0xfd) {
+         *q++ = 0x7e;  *q++ = c - 0x7e + 1;
+      } else {
+         *q++ = 0x7f;  *q++ = c - 0xfc;
       }
    }
 
-   // =========================================================================
+   *q = '\0';
+   return q - (unsigned char *)dst;
+}
 
-   // Load file into memory
-   start = STOPWATCH_BEGIN();
+// Keys of the lines a[lo, hi) into kp. Returns 0, or -1 when out of memory.
+
+template <typename S>
+static int
+collate_keys(collate_opts *co, S *a, size_t lo, size_t hi, key_part *kp)
+{
+   size_t i, j, len, need, fcap = 0, xcap = 0;
+   char *s, *fbuf = NULL, *xbuf = NULL, *p;
+
+   memset(kp, 0, sizeof(key_part));
+
+   for (i = lo; i < hi; i++) {
+      s = str_of(a[i]);  len = strlen(s);
+
+      if (co->fold_flag) {
+         if (len + 1 > fcap) {
+            fcap = 2 * (len + 1);
+            if ((p = (char *)realloc(fbuf, fcap)) == NULL) break;
+            fbuf = p;
+         }
+         for (j = 0; j <= len; j++) fbuf[j] = co->fold[(unsigned char)s[j]];
+         s = fbuf;
+      }
+
+      if (co->xfrm_flag) {
+         while ((need = strxfrm(xbuf, s, xcap)) >= xcap) {
+            xcap = 2 * need + 64;
+            if ((p = (char *)realloc(xbuf, xcap)) == NULL) break;
+            xbuf = p;
+         }
+         if (need >= xcap) break;
+         s = xbuf;  len = need;
+      }
+
+      // Key, NUL and reference
+      if (kp->size + 2 * len + 1 + sizeof(S) > kp->cap) {
+         kp->cap = std::max(2 * kp->cap, kp->size + 2 * len + ALLOC_SIZE);
+         if ((p = (char *)realloc(kp->buf, kp->cap)) == NULL) break;
+         kp->buf = p;
+      }
 
-   if ((space = (char *)malloc(sizeof(char) * size)) == NULL) {
-      fprintf(stderr, "%s: Could not allocate memory for file\n", argv[0]);
-      fclose(fp); exit(1);
+      len = key_escape(kp->buf + kp->size, s, len);
+      kp->counts[(unsigned char)kp->buf[kp->size]]++;
+      kp->size += len + 1;
+      memcpy(kp->buf + kp->size, &a[i], sizeof(S));  kp->size += sizeof(S);
    }
 
-   fread(space, sizeof(char), size, fp);
-   fclose(fp);
+   free((void*)fbuf);  free((void*)xbuf);
 
-   load_t = STOPWATCH_END(start);
+   return (i < hi) ? -1 : 0;
+}
 
-   // Create pointer array
-   start = STOPWATCH_BEGIN();
-   a = create_pointer_array(argv[0], space, size, &n);
-   ptrary_t = STOPWATCH_END(start);
+// Sort the keys in space, referenced by k, and replace a with the lines in
+// that order. text is the string space of a.
+
+template <typename S, typename K>
+static int
+collate_finish(char *text, S *a, size_t n, collate_opts *co, int check_flag,
+               timings *t)
+{
+   std::chrono::steady_clock::time_point start;
+   int check_status = 0, c;
+   size_t i, j;
+   K *k;
+
+   // One spare entry, as in the arrays of create_pointer_array
+   if ((k = (K *)malloc(sizeof(K) * (n + 1))) == NULL)
+      return -1;
+
+   for (i = 0, j = 0; i < n; i++) {
+      k[i] = str_ref<K>(space + j);
+      j += strlen(space + j) + 1 + sizeof(S);
+   }
 
-   // Sort pointer array
+   // Sort keys, then lines with equal keys
    start = STOPWATCH_BEGIN();
-   sort_main(a, n);
-   sort_t = STOPWATCH_END(start);
+   if (n > 0) sort_main(k, n);
 
-   // Check sorted
+   auto line_cmp = [=](S x, S y) {
+      char *p = text_of(text, x), *q = text_of(text, y);
+      int c = co->xfrm_flag ? strcoll(p, q) : 0;
+      return ((c != 0) ? c : scmp(p, q)) < 0;
+   };
+
+   for (i = 0; i < n; i = j) {
+      a[i] = line_ref<S>(str_of(k[i]));
+
+      for (j = i + 1; j < n && scmp(str_of(k[j - 1]), str_of(k[j])) == 0; j++)
+         a[j] = line_ref<S>(str_of(k[j]));
+
+      if (j - i > 1)
+         std::sort(a + i, a + j, line_cmp);
+   }
+
+   t->sort_t = STOPWATCH_END(start);
+
+   // Check sorted, by key and line
    if (check_flag) {
       start = STOPWATCH_BEGIN();
-      check_status = check_array(a, n);
-      check_t = STOPWATCH_END(start);
-   } else {
-      check_t = 0.0;
+
+      for (i = 1; i < n; i++) {
+         c = scmp(str_of(k[i - 1]), str_of(k[i]));
+         if (c > 0 || (c == 0 && line_cmp(a[i], a[i - 1]))) break;
+      }
+
+      check_status = (i < n);
+      t->check_t = STOPWATCH_END(start);
    }
 
-   // Output sorted
-   if (no_output_flag == 0) {
-      start = STOPWATCH_BEGIN();
-      fd = (oname != NULL) ? fileno(op) : fileno(stdout);
+   free((void*)k);
 
-      if (reverse_flag)
-         output_descending(argv[0], fd, a, n);
-      else
-         output_ascending(argv[0], fd, a, n);
+   return check_status;
+}
 
-      if (oname != NULL) fclose(op);
-      save_t = STOPWATCH_END(start);
+// Sort a by collation. Keys are built by n_threads threads, each over its
+// share of the lines, and gathered into one arena that takes the place of
+// space while the kernel runs. Returns the check status, or -1 when out of
+// memory.
 
-   } else {
-      save_t = 0.0;
+template <typename S>
+static int
+collate_sort(char *name, S *a, size_t n, collate_opts *co, int check_flag,
+             timings *t)
+{
+   std::chrono::steady_clock::time_point start = STOPWATCH_BEGIN();
+   std::vector<std::thread> threads;
+   std::vector<int> status;
+   int i, nt, check_status, failed = 0;
+   char *text = space, *keys;
+   size_t c, size = 0;
+   key_part *kp;
+
+   nt = (n / COLLATE_MIN < (size_t)n_threads) ? n / COLLATE_MIN : n_threads;
+   if (nt < 1) nt = 1;
+
+   if ((kp = (key_part *)malloc(sizeof(key_part) * nt)) == NULL) {
+      fprintf(stderr, "%s: Could not allocate memory for keys\n", name);
+      return -1;
    }
 
-   // Free memory
-   start = STOPWATCH_BEGIN();
-   free((void*)a); free((void*)space);
-   free_t = STOPWATCH_END(start);
+   status.resize(nt);
 
-   // =========================================================================
+   for (i = 0; i < nt; i++)
+      threads.push_back(std::thread([=, &status]() {
+         status[i] = collate_keys(co, a, n * i / nt, n * (i + 1) / nt, &kp[i]);
+      }));
 
-   if (bm_flag) {
-      if (bname != NULL) {
-         bp = fopen(bname, "w");
+   for (auto &th : threads)
+      th.join();
 
-         output_bm(bp, \
-            load_t, ptrary_t, sort_t, check_t, save_t, free_t, check_status);
+   memset(depth0_counts, 0, sizeof(depth0_counts));
 
-         fclose(bp);
+   for (i = 0; i < nt; i++) {
+      if (status[i] != 0) failed = 1;
+      for (c = 0; c < 256; c++) depth0_counts[c] += kp[i].counts[c];
+      size += kp[i].size;
+   }
 
-      } else {
-         output_bm(stderr, \
-            load_t, ptrary_t, sort_t, check_t, save_t, free_t, check_status);
-      }
+   if (failed || (keys = (char *)malloc(size + SPACE_PAD)) == NULL) {
+      fprintf(stderr, "%s: Could not allocate memory for keys\n", name);
+      for (i = 0; i < nt; i++) free((void*)kp[i].buf);
+      free((void*)kp); return -1;
    }
 
-   return 0;
+   for (i = 0, size = 0; i < nt; i++) {
+      memcpy(keys + size, kp[i].buf, kp[i].size);
+      size += kp[i].size;  free((void*)kp[i].buf);
+   }
+
+   memset(keys + size, 0, SPACE_PAD);
+   free((void*)kp);
+
+   t->ptrary_t += STOPWATCH_END(start);
+
+   // Keys take the place of the lines while sorting
+   space = keys;  depth0_hist = depth0_counts;
+
+   if (size <= UINT32_MAX)
+      check_status = collate_finish<S, offset_t>(text, a, n, co,
+         check_flag, t);
+   else
+      check_status = collate_finish<S, char *>(text, a, n, co,
+         check_flag, t);
+
+   space = text;  depth0_hist = NULL;
+   free((void*)keys);
+
+   if (check_status < 0)
+      fprintf(stderr, "%s: Could not allocate key array\n", name);
+
+   return check_status;
 }
 
+// ############################################################################
+
+// Merge of sorted runs of strings. Runs are merged with a loser tree that
+// keeps for each run the length of the common prefix of its current string
+// with the last string output. A match between strings of different LCPs is
+// decided by the LCPs alone, and strings of equal LCP are compared from that
+// depth on only.
+
+#define MERGE_SAMPLES 64         // per run and thread, to pick splitters
+#define MERGE_CUTOFF  65536      // merge in parallel above this many strings
+
+template <typename S>
+struct merge_run {
+   S *cur, *end;
+};
+
+template <typename S>
+struct loser_tree {
+   size_t k;                     // leaves, a power of two
+   merge_run<S> *run;
+   size_t *lcp;                  // of the current string of each run
+   size_t *node;                 // run that lost the match at each node
+   int reverse_flag;
+};
+
+// Play run i against run j, returning the winner. The LCP of the loser is
+// set relative to the winner. Exhausted runs lose every match.
+
+template <typename S>
+static inline size_t
+play(loser_tree<S> *lt, size_t i, size_t j)
+{
+   merge_run<S> *run = lt->run;
+   char *s, *t;
+   size_t h;
+   int c;
+
+   if (run[j].cur == run[j].end) return i;
+   if (run[i].cur == run[i].end) return j;
+
+   if (lt->lcp[i] != lt->lcp[j])
+      return (lt->lcp[i] > lt->lcp[j]) ? i : j;
+
+   h = lt->lcp[i];
+   s = str_of(*run[i].cur) + h;  t = str_of(*run[j].cur) + h;
+
+   while (*s == *t && *s != 0) { s++; t++; h++; }
+
+   c = (unsigned char)*s - (unsigned char)*t;
+   if (lt->reverse_flag) c = -c;
+
+   if (c <= 0) {
+      lt->lcp[j] = h; return i;
+   } else {
+      lt->lcp[i] = h; return j;
+   }
+}
+
+template <typename S>
+static size_t
+build_tree(loser_tree<S> *lt, size_t v)
+{
+   size_t w1, w2, w;
+
+   if (v >= lt->k)
+      return v - lt->k;
+
+   w1 = build_tree(lt, 2 * v);  w2 = build_tree(lt, 2 * v + 1);
+   w = play(lt, w1, w2);
+   lt->node[v] = (w == w1) ? w2 : w1;
+
+   return w;
+}
+
+// Returns 0, or -1 when the tree cannot be allocated.
+
+template <typename S>
+static int
+merge_runs(merge_run<S> *runs, size_t k, S *out, int reverse_flag)
+{
+   loser_tree<S> lt;
+   size_t i, h, v, w, l;
+   char *p, *q;
+
+   for (lt.k = 2; lt.k < k; lt.k *= 2) ;
+
+   lt.run  = (merge_run<S> *)calloc(lt.k, sizeof(merge_run<S>));
+   lt.lcp  = (size_t *)calloc(lt.k, sizeof(size_t));
+   lt.node = (size_t *)calloc(lt.k, sizeof(size_t));
+   lt.reverse_flag = reverse_flag;
+
+   if (lt.run == NULL || lt.lcp == NULL || lt.node == NULL) {
+      free((void*)lt.run); free((void*)lt.lcp); free((void*)lt.node);
+      return -1;
+   }
+
+   for (i = 0; i < k; i++)
+      lt.run[i] = runs[i];
+
+   w = build_tree(&lt, 1);
+
+   while (lt.run[w].cur != lt.run[w].end) {
+      *out++ = *lt.run[w].cur;
+      p = str_of(*lt.run[w].cur++);
+
+      // The next string of the run follows p, so its LCP with p is its LCP
+      // with the string just output
+      if (lt.run[w].cur != lt.run[w].end) {
+         q = str_of(*lt.run[w].cur);
+         for (h = 0; p[h] == q[h] && p[h] != 0; h++) ;
+         lt.lcp[w] = h;
+      }
+
+      for (v = (w + lt.k) / 2; v > 0; v /= 2) {
+         l = lt.node[v];
+         if (play(&lt, w, l) == l) { lt.node[v] = w; w = l; }
+      }
+   }
+
+   free((void*)lt.run); free((void*)lt.lcp); free((void*)lt.node);
+   return 0;
+}
+
+// Number of strings of the run ordered before s
+
+template <typename S>
+static size_t
+run_rank(merge_run<S> *run, char *s, int reverse_flag)
+{
+   size_t lo = 0, hi = run->end - run->cur, mid;
+   int c;
+
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      c = scmp(str_of(run->cur[mid]), s);
+      if (reverse_flag) c = -c;
+      if (c < 0) lo = mid + 1; else hi = mid;
+   }
+
+   return lo;
+}
+
+// Splits the runs by splitters sampled from all of them. Each thread merges
+// the strings between two splitters into its own range of out. Returns 0,
+// or -1 as merge_runs.
+
+template <typename S>
+static int
+merge_parallel(merge_run<S> *runs, size_t k, S *out, size_t n,
+               int reverse_flag)
+{
+   size_t nt = n_threads, i, j, len, off;
+
+   if (nt < 2 || n < MERGE_CUTOFF)
+      return merge_runs(runs, k, out, reverse_flag);
+
+   std::vector<char *> sample;
+
+   for (j = 0; j < k; j++) {
+      len = runs[j].end - runs[j].cur;
+      for (i = 1; len > 0 && i <= MERGE_SAMPLES * nt; i++)
+         sample.push_back(str_of(runs[j].cur[len * i / (MERGE_SAMPLES*nt+1)]));
+   }
+
+   std::sort(sample.begin(), sample.end(), [=](char *s, char *t) {
+      return reverse_flag ? scmp(s, t) > 0 : scmp(s, t) < 0;
+   });
+
+   // Part p takes from run j the strings in [bound[p][j], bound[p+1][j])
+   std::vector<size_t> bound((nt + 1) * k);
+   std::vector<merge_run<S>> part(nt * k);
+   std::vector<std::thread> threads;
+   std::vector<int> status(nt);
+
+   for (j = 0; j < k; j++) {
+      bound[j] = 0;
+      bound[nt * k + j] = runs[j].end - runs[j].cur;
+
+      for (i = 1; i < nt; i++)
+         bound[i * k + j] = run_rank(&runs[j],
+            sample[i * sample.size() / nt], reverse_flag);
+   }
+
+   for (i = 0, off = 0; i < nt; i++) {
+      for (j = 0, len = 0; j < k; j++) {
+         part[i * k + j].cur = runs[j].cur + bound[i * k + j];
+         part[i * k + j].end = runs[j].cur + bound[(i + 1) * k + j];
+         len += bound[(i + 1) * k + j] - bound[i * k + j];
+      }
+
+      threads.push_back(std::thread([=, &part, &status]() {
+         status[i] = merge_runs(&part[i * k], k, out + off, reverse_flag);
+      }));
+
+      off += len;
+   }
+
+   for (auto &th : threads)
+      th.join();
+
+   for (i = 0; i < nt; i++)
+      if (status[i] != 0) return -1;
+
+   return 0;
+}
+
+// ############################################################################
+
+// Presorted input. Before sorting, the array is scanned for runs, each of
+// n_threads threads over its share: ascending, or descending which are
+// reversed. Neighbouring runs in order are joined. A single run leaves
+// nothing to sort; a few long runs are merged as above instead. The scan
+// gives up after PRESORT_MIN_RUN strings per run on average, so that it
+// costs little for unordered input.
+
+#define PRESORT_MIN_RUN 256      // average run length to merge runs
+
+struct presort_run {
+   size_t lo, hi;
+   int desc;
+};
+
+// Runs of a[lo, hi). Returns 0, or -1 once the runs counted by all threads
+// exceed max.
+
+template <typename S>
+static int
+find_runs(S *a, size_t lo, size_t hi, std::atomic<size_t> *count, size_t max,
+          std::vector<presort_run> *runs)
+{
+   size_t i, j;
+   int desc;
+
+   for (i = lo; i < hi; i = j) {
+      if (++*count > max)
+         return -1;
+
+      j = i + 1;
+      desc = (j < hi && scmp(str_of(a[i]), str_of(a[j])) > 0);
+
+      if (desc)
+         while (j < hi && scmp(str_of(a[j - 1]), str_of(a[j])) >= 0) j++;
+      else
+         while (j < hi && scmp(str_of(a[j - 1]), str_of(a[j])) <= 0) j++;
+
+      runs->push_back(presort_run{ i, j, desc });
+   }
+
+   return 0;
+}
+
+// Sorts a when it consists of few runs. Returns 1 when sorted, 0 when the
+// runs are too short, or memory for the merge is short, and a is left for
+// the kernel, in some other order.
+
+template <typename S>
+static int
+sort_presorted(S *a, size_t n)
+{
+   size_t nt = n_threads, i, j, max;
+   std::vector<std::vector<presort_run>> part;
+   std::vector<presort_run> runs;
+   std::vector<std::thread> threads;
+   std::vector<int> status;
+   std::atomic<size_t> count(0);
+   S *out;
+
+   if (n < 2)
+      return 1;
+
+   if (nt > n / PRESORT_MIN_RUN) nt = n / PRESORT_MIN_RUN;
+   if (nt < 1) nt = 1;
+
+   max = n / PRESORT_MIN_RUN + nt;
+   part.resize(nt);  status.resize(nt);
+
+   for (i = 0; i < nt; i++)
+      threads.push_back(std::thread([=, &part, &status, &count]() {
+         status[i] = find_runs(a, n * i / nt, n * (i + 1) / nt, &count, max,
+            &part[i]);
+      }));
+
+   for (auto &th : threads)
+      th.join();
+
+   for (i = 0; i < nt; i++)
+      if (status[i] != 0) return 0;
+
+   // Join runs across the shares, descending first, then reverse those
+   for (i = 0; i < nt; i++) {
+      for (auto &r : part[i]) {
+         if (!runs.empty() && r.desc && runs.back().desc &&
+               scmp(str_of(a[r.lo - 1]), str_of(a[r.lo])) >= 0)
+            runs.back().hi = r.hi;
+         else
+            runs.push_back(r);
+      }
+   }
+
+   for (auto &r : runs) {
+      if (r.desc) {
+         std::reverse(a + r.lo, a + r.hi);  r.desc = 0;
+      }
+   }
+
+   for (i = 1, j = 0; i < runs.size(); i++) {
+      if (scmp(str_of(a[runs[j].hi - 1]), str_of(a[runs[i].lo])) <= 0)
+         runs[j].hi = runs[i].hi;
+      else
+         runs[++j] = runs[i];
+   }
+
+   runs.resize(j + 1);
+
+   if (runs.size() == 1)
+      return 1;
+
+   // Merge the runs
+   std::vector<merge_run<S>> mr(runs.size());
+
+   for (i = 0; i < runs.size(); i++) {
+      mr[i].cur = a + runs[i].lo;  mr[i].end = a + runs[i].hi;
+   }
+
+   if ((out = (S *)malloc(sizeof(S) * (n + 1))) == NULL)
+      return 0;
+
+   if (merge_parallel(mr.data(), mr.size(), out, n, 0) != 0) {
+      free((void*)out); return 0;
+   }
+
+   memcpy(a, out, sizeof(S) * n);
+   free((void*)out);
+
+   return 1;
+}
+
+// Load, sort, check and output the file using string references of type S.
+// Output is skipped when op is NULL, the index unless ix is given. Lines
+// are ordered by collation when co is given, by bytes otherwise. Returns
+// the check status, or -1 on failure, fp and op being closed either way.
+
+template <typename S>
+static int
+sort_file(char *name, FILE *fp, size_t size, FILE *op, index_opts *ix,
+          collate_opts *co, int reverse_flag, int check_flag, timings *t)
+{
+   std::chrono::steady_clock::time_point start;
+   int check_status = 0;
+   size_t n = 0;
+   S *a;
+
+   // Load file into memory and create pointer array, both in one pass
+   start = STOPWATCH_BEGIN();
+
+   if ((space = (char *)arena_alloc(ARENA_TEXT, size + SPACE_PAD)) == NULL) {
+      fprintf(stderr, "%s: Could not allocate memory for file\n", name);
+      fclose(fp); goto fail;
+   }
+   memset(space + size, 0, SPACE_PAD);
+
+   a = create_pointer_array<S>(name, fileno(fp), space, &size, &n,
+                               &t->ptrary_t);
+   fclose(fp);
+
+   if (a == NULL) {
+      arena_free(ARENA_TEXT, space); goto fail;
+   }
+
+   t->load_t = STOPWATCH_END(start);
+   t->load_t -= t->ptrary_t;
+
+   t->bytes = size;  t->lines = n;  t->check_t = 0.0;
+
+   if (co != NULL) {
+      // Sort by collation keys, then check
+      if ((check_status = collate_sort(name, a, n, co, check_flag, t)) < 0) {
+         free((void*)a); arena_free(ARENA_TEXT, space); goto fail;
+      }
+   }
+   else {
+      // Sort pointer array, unless it is made of few runs
+      start = STOPWATCH_BEGIN();
+      depth0_hist = depth0_counts;
+      if (!sort_presorted(a, n)) sort_main(a, n);
+      depth0_hist = NULL;
+      t->sort_t = STOPWATCH_END(start);
+
+      // Check sorted
+      if (check_flag) {
+         start = STOPWATCH_BEGIN();
+         check_status = check_array(a, n);
+         t->check_t = STOPWATCH_END(start);
+      }
+   }
+
+   // Output sorted
+   start = STOPWATCH_BEGIN();
+
+   if (ix != NULL)
+      output_index(name, a, n, size, reverse_flag, ix);
+
+   if (op != NULL) {
+      if (n == 0)
+         ;
+      else if (reverse_flag)
+         output_descending(name, fileno(op), a, n);
+      else
+         output_ascending(name, fileno(op), a, n);
+
+      if (op != stdout) fclose(op);
+   }
+
+   t->save_t = STOPWATCH_END(start);
+
+   // Free memory
+   start = STOPWATCH_BEGIN();
+   free((void*)a); arena_free(ARENA_TEXT, space);
+   t->free_t = STOPWATCH_END(start);
+
+   return check_status;
+
+fail:
+   if (op != NULL && op != stdout) fclose(op);
+   return -1;
+}
+
+// ############################################################################
+
+// Merge of presorted files (--merge), or of a sorted base with a file that
+// is sorted here first (--delta=base). The files are loaded one after the
+// other into space, so strings are referenced as for a single file. Inputs
+// must be in the requested order, ascending, or descending with -r.
+
+// Load, merge, check and output the files using string references of type
+// S. With sort_last, the last file is sorted with the kernel before it is
+// merged into the others.
+
+template <typename S>
+static int
+merge_files(char *name, int k, FILE **fps, size_t *sizes, int sort_last,
+            FILE *op, int reverse_flag, int check_flag, timings *t)
+{
+   std::chrono::steady_clock::time_point start;
+   size_t size = 0, n = 0, i, off;
+   int check_status = 0, c, j;
+   double ptrary_t;
+   S *out;
+
+   merge_run<S> *runs = (merge_run<S> *)malloc(sizeof(merge_run<S>) * k);
+   S **a = (S **)malloc(sizeof(S *) * k);
+
+   // Load files into memory and create a pointer array for each
+   start = STOPWATCH_BEGIN();
+
+   for (j = 0; j < k; j++)
+      size += sizes[j];
+
+   if (runs == NULL || a == NULL ||
+         (space = (char *)malloc(sizeof(char) * size + SPACE_PAD)) == NULL) {
+      fprintf(stderr, "%s: Could not allocate memory for files\n", name);
+      exit(1);
+   }
+
+   for (j = 0, off = 0, t->ptrary_t = 0.0; j < k; j++) {
+      size_t nj = 0;
+
+      a[j] = create_pointer_array<S>(name, fileno(fps[j]), space + off,
+         &sizes[j], &nj, &ptrary_t);
+      fclose(fps[j]);
+
+      if (a[j] == NULL)
+         exit(1);
+
+      runs[j].cur = a[j];  runs[j].end = a[j] + nj;
+      off += sizes[j];  n += nj;  t->ptrary_t += ptrary_t;
+   }
+
+   memset(space + off, 0, SPACE_PAD);
+
+   t->load_t = STOPWATCH_END(start);
+   t->load_t -= t->ptrary_t;
+   t->bytes = off;  t->lines = n;
+
+   // Sort the delta, then merge
+   start = STOPWATCH_BEGIN();
+
+   if (sort_last && runs[k - 1].end > runs[k - 1].cur) {
+      depth0_hist = depth0_counts;
+      sort_main(a[k - 1], runs[k - 1].end - runs[k - 1].cur);
+      depth0_hist = NULL;
+
+      if (reverse_flag) {
+         for (S *p = runs[k - 1].cur, *q = runs[k - 1].end - 1; p < q;) {
+            S x = *p; *p++ = *q; *q-- = x;
+         }
+      }
+   }
+
+   if ((out = (S *)malloc(sizeof(S) * (n + 1))) == NULL) {
+      fprintf(stderr, "%s: Could not allocate ptr array\n", name);
+      exit(1);
+   }
+
+   if (merge_parallel(runs, k, out, n, reverse_flag) != 0) {
+      fprintf(stderr, "%s: Could not allocate loser tree\n", name);
+      exit(1);
+   }
+
+   for (j = 0; j < k; j++)
+      free((void*)a[j]);
+
+   t->sort_t = STOPWATCH_END(start);
+
+   // Check sorted
+   if (check_flag) {
+      start = STOPWATCH_BEGIN();
+
+      for (i = 1; i < n; i++) {
+         c = scmp(str_of(out[i - 1]), str_of(out[i]));
+         if (reverse_flag ? c < 0 : c > 0) { check_status = 1; break; }
+      }
+
+      t->check_t = STOPWATCH_END(start);
+   } else {
+      t->check_t = 0.0;
+   }
+
+   // Output merged, already in the requested order
+   start = STOPWATCH_BEGIN();
+
+   if (op != NULL) {
+      if (n > 0)
+         output_ascending(name, fileno(op), out, n);
+
+      if (op != stdout) fclose(op);
+   }
+
+   t->save_t = STOPWATCH_END(start);
+
+   // Free memory
+   start = STOPWATCH_BEGIN();
+   free((void*)out); free((void*)space); free((void*)a); free((void*)runs);
+   t->free_t = STOPWATCH_END(start);
+
+   return check_status;
+}
+
+static int
+merge_main(char *name, int k, char **fnames, int sort_last, FILE *op,
+           int reverse_flag, int check_flag, timings *t)
+{
+   FILE **fps = (FILE **)malloc(sizeof(FILE *) * k);
+   size_t *sizes = (size_t *)malloc(sizeof(size_t) * k), size = 0;
+   int j, check_status;
+   off_t sz;
+
+   if (fps == NULL || sizes == NULL) {
+      fprintf(stderr, "%s: Could not allocate memory\n", name);
+      exit(1);
+   }
+
+   for (j = 0; j < k; j++) {
+      if ((fps[j] = fopen(fnames[j], "r")) == NULL) {
+         fprintf(stderr, "%s: Could not open %s for reading\n",
+            name, fnames[j]);
+         exit(1);
+      }
+      if ((sz = get_size(fileno(fps[j]))) == -1) {
+         fprintf(stderr, "%s: %s is not a regular file\n", name, fnames[j]);
+         exit(1);
+      }
+      sizes[j] = sz;  size += sz;
+   }
+
+   if (size <= UINT32_MAX)
+      check_status = merge_files<offset_t>(name, k, fps, sizes, sort_last,
+         op, reverse_flag, check_flag, t);
+   else
+      check_status = merge_files<char *>(name, k, fps, sizes, sort_last,
+         op, reverse_flag, check_flag, t);
+
+   free((void*)fps); free((void*)sizes);
+
+   return check_status;
+}
+
+// ############################################################################
+
+// Distributed sort (--dist-rank=R --dist-peers=ADDR,...), see dist.h. Each
+// of the N processes loads the lines starting in its N-th of the file.
+// Splitters are picked from samples gathered from all processes, and each
+// line is sent to the process owning its key range. Every process sorts
+// what it received with the kernel, then writes it at the sum of the sizes
+// of the partitions of lower rank.
+
+#define DIST_SAMPLES 256         // per process, to pick splitters
+
+// Offset of the first line starting at or after pos
+
+static off_t
+line_start(int fd, off_t pos, off_t size)
+{
+   char buf[65536], *p;
+   ssize_t r;
+
+   if (pos == 0)
+      return 0;
+
+   for (pos--; pos < size; pos += r) {
+      if ((r = pread(fd, buf, sizeof(buf), pos)) <= 0)
+         return size;
+      if ((p = (char *)memchr(buf, '\n', r)) != NULL)
+         return pos + (p - buf) + 1;
+   }
+
+   return size;
+}
+
+// Pointer array of the newline-terminated lines in space, which are
+// terminated with a NUL instead
+
+template <typename S>
+static S *
+index_lines(char *name, size_t size, size_t *np)
+{
+   char *s = space, *end = space + size, *p;
+   size_t n = 0;
+   S *a;
+
+   for (p = s; (p = (char *)memchr(p, '\n', end - p)) != NULL; p++) n++;
+
+   if ((a = (S *)malloc(sizeof(S) * (n + 1))) == NULL) {
+      fprintf(stderr, "%s: Could not allocate ptr array\n", name);
+      exit(1);
+   }
+
+   memset(depth0_counts, 0, sizeof(depth0_counts));
+
+   for (n = 0; (p = (char *)memchr(s, '\n', end - s)) != NULL; s = p + 1) {
+      depth0_counts[(*s == '\n') ? 0 : (unsigned char)*s]++;
+      *p = '\0'; a[n++] = str_ref<S>(s);
+   }
+
+   *np = n;
+   return a;
+}
+
+// Sort the partition received into space and output it
+
+template <typename S>
+static int
+dist_sort(char *name, size_t size, FILE *op, int reverse_flag,
+          int check_flag, timings *t)
+{
+   std::chrono::steady_clock::time_point start;
+   int check_status = 0;
+   size_t n = 0;
+   S *a;
+
+   start = STOPWATCH_BEGIN();
+   a = index_lines<S>(name, size, &n);
+   t->ptrary_t += STOPWATCH_END(start);
+   t->bytes = size;  t->lines = n;
+
+   start = STOPWATCH_BEGIN();
+   depth0_hist = depth0_counts;
+   if (n > 0) sort_main(a, n);
+   depth0_hist = NULL;
+   t->sort_t = STOPWATCH_END(start);
+
+   if (check_flag) {
+      start = STOPWATCH_BEGIN();
+      check_status = check_array(a, n);
+      t->check_t = STOPWATCH_END(start);
+   } else {
+      t->check_t = 0.0;
+   }
+
+   start = STOPWATCH_BEGIN();
+
+   if (op != NULL) {
+      if (n == 0)
+         ;
+      else if (reverse_flag)
+         output_descending(name, fileno(op), a, n);
+      else
+         output_ascending(name, fileno(op), a, n);
+
+      if (op != stdout) fclose(op);
+   }
+
+   t->save_t = STOPWATCH_END(start);
+
+   start = STOPWATCH_BEGIN();
+   free((void*)a); free((void*)space);
+   t->free_t = STOPWATCH_END(start);
+
+   return check_status;
+}
+
+static int
+dist_main(char *name, char *fname, int rank, char *peers, char *oname,
+          off_t seek_off, int no_output_flag, int reverse_flag,
+          int check_flag, timings *t)
+{
+   std::chrono::steady_clock::time_point start;
+   size_t len, i, j, k, m, total;
+   uint64_t offset, all_size;
+   off_t size, lo, hi;
+   char *text, *end, *sendb, *s, *p;
+   int fd, N;
+   FILE *op = NULL;
+   dist d;
+
+   if (dist_open(&d, rank, peers) != 0) {
+      fprintf(stderr, "%s: Could not connect to peers %s\n", name, peers);
+      exit(1);
+   }
+
+   N = d.size;
+   std::vector<char *> sbuf(N), rbuf(N);
+   std::vector<size_t> slen(N), rlen(N);
+   std::vector<uint64_t> vals(N), scount(N), rcount(N);
+
+   // Load the lines starting in this process's part of the file
+   start = STOPWATCH_BEGIN();
+
+   if ((fd = open(fname, O_RDONLY)) < 0 || (size = get_size(fd)) == -1) {
+      fprintf(stderr, "%s: Could not open %s for reading\n", name, fname);
+      exit(1);
+   }
+
+   lo = line_start(fd, size / N * rank, size);
+   hi = (rank == N - 1) ? size : line_start(fd, size / N * (rank + 1), size);
+
+   if ((text = (char *)malloc(hi - lo + SPACE_PAD)) == NULL) {
+      fprintf(stderr, "%s: Could not allocate memory for file\n", name);
+      exit(1);
+   }
+
+   for (len = 0; len < (size_t)(hi - lo); len += k) {
+      ssize_t r = pread(fd, text + len, hi - lo - len, lo + len);
+      if (r <= 0) break;
+      k = r;
+   }
+
+   close(fd);
+   memset(text + len, 0, SPACE_PAD);
+
+   // An unterminated last line is not part of the output
+   for (end = text + len; end > text && end[-1] != '\n'; end--) ;
+
+   t->load_t = STOPWATCH_END(start);
+
+   // Every process sends all others evenly spaced lines as samples
+   start = STOPWATCH_BEGIN();
+
+   std::vector<char> mine;
+
+   for (i = 1; end > text && i <= DIST_SAMPLES; i++) {
+      for (s = text + (end - text) * i / (DIST_SAMPLES + 1);
+            s > text && s[-1] != '\n'; s--) ;
+      p = (char *)memchr(s, '\n', end - s);
+      mine.insert(mine.end(), s, p);  mine.push_back('\0');
+   }
+
+   vals[rank] = mine.size();
+
+   if (dist_allgather(&d, vals.data()) != 0) {
+      fprintf(stderr, "%s: Could not exchange samples\n", name);
+      exit(1);
+   }
+
+   for (j = 0, total = 0; j < (size_t)N; j++)
+      total += vals[j];
+
+   std::vector<char> all(total + SPACE_PAD, 0);
+
+   for (j = 0, m = 0; j < (size_t)N; j++) {
+      sbuf[j] = mine.data();  slen[j] = mine.size();
+      rbuf[j] = all.data() + m;  rlen[j] = vals[j];  m += vals[j];
+   }
+
+   if (dist_alltoall(&d, sbuf.data(), slen.data(), rbuf.data(),
+         rlen.data()) != 0) {
+      fprintf(stderr, "%s: Could not exchange samples\n", name);
+      exit(1);
+   }
+
+   std::vector<char *> sample, split;
+
+   for (s = all.data(); s < all.data() + total; s += strlen(s) + 1)
+      sample.push_back(s);
+
+   auto before = [=](const char *s, const char *t) {
+      return reverse_flag ? scmp(s, t) > 0 : scmp(s, t) < 0;
+   };
+
+   // All processes sort the same samples, hence agree on the splitters.
+   // Process i receives the lines from splitter i - 1 up to splitter i.
+   std::sort(sample.begin(), sample.end(), before);
+
+   for (i = 1; !sample.empty() && i < (size_t)N; i++)
+      split.push_back(sample[i * sample.size() / N]);
+
+   // Destination of each line, then the lines grouped by destination
+   std::vector<uint32_t> dest;
+   std::vector<size_t> pos(N);
+
+   for (j = 0; j < (size_t)N; j++)
+      scount[j] = 0;
+
+   for (s = text; s < end; s = p + 1) {
+      p = (char *)memchr(s, '\n', end - s);  *p = '\0';
+      k = std::upper_bound(split.begin(), split.end(), s, before)
+        - split.begin();
+      dest.push_back(k);  scount[k] += p - s + 1;
+   }
+
+   if ((sendb = (char *)malloc(end - text + 1)) == NULL) {
+      fprintf(stderr, "%s: Could not allocate memory for lines\n", name);
+      exit(1);
+   }
+
+   for (j = 0, m = 0; j < (size_t)N; j++) {
+      pos[j] = m;  m += scount[j];
+   }
+
+   for (s = text, i = 0; s < end; s += k + 1, i++) {
+      k = strlen(s);
+      memcpy(sendb + pos[dest[i]], s, k);  sendb[pos[dest[i]] + k] = '\n';
+      pos[dest[i]] += k + 1;
+   }
+
+   free((void*)text);
+   t->ptrary_t = STOPWATCH_END(start);
+
+   // Exchange the sizes of the partitions, then the lines
+   start = STOPWATCH_BEGIN();
+
+   if (dist_alltoall64(&d, scount.data(), rcount.data()) != 0) {
+      fprintf(stderr, "%s: Could not exchange lines\n", name);
+      exit(1);
+   }
+
+   for (j = 0, total = 0; j < (size_t)N; j++)
+      total += rcount[j];
+
+   if ((space = (char *)malloc(sizeof(char) * total + SPACE_PAD)) == NULL) {
+      fprintf(stderr, "%s: Could not allocate memory for lines\n", name);
+      exit(1);
+   }
+   memset(space + total, 0, SPACE_PAD);
+
+   for (j = 0, m = 0; j < (size_t)N; j++) {
+      sbuf[j] = sendb + pos[j] - scount[j];  slen[j] = scount[j];
+      rbuf[j] = space + m;  rlen[j] = rcount[j];  m += rcount[j];
+   }
+
+   if (dist_alltoall(&d, sbuf.data(), slen.data(), rbuf.data(),
+         rlen.data()) != 0) {
+      fprintf(stderr, "%s: Could not exchange lines\n", name);
+      exit(1);
+   }
+
+   free((void*)sendb);
+
+   // The output of this process starts after the partitions of lower rank
+   vals[rank] = total;
+
+   if (dist_allgather(&d, vals.data()) != 0) {
+      fprintf(stderr, "%s: Could not exchange sizes\n", name);
+      exit(1);
+   }
+
+   for (j = 0, offset = 0, all_size = 0; j < (size_t)N; j++) {
+      if (j < (size_t)rank) offset += vals[j];
+      all_size += vals[j];
+   }
+
+   dist_close(&d);
+   t->load_t += STOPWATCH_END(start);
+
+   if (no_output_flag)
+      op = NULL;
+   else if (oname == NULL)
+      op = stdout;
+   else {
+      if ((op = fopen_at(oname, (seek_off < 0 ? 0 : seek_off) + offset))
+            == NULL) {
+         fprintf(stderr, "%s: Could not open %s for writing\n", name, oname);
+         exit(1);
+      }
+
+      // Set the final size, which is safe while others write below it
+      if (seek_off < 0 && rank == 0 && ftruncate(fileno(op), all_size) != 0)
+         fprintf(stderr, "%s: Could not truncate %s\n", name, oname);
+   }
+
+   if (total <= UINT32_MAX)
+      return dist_sort<offset_t>(name, total, op, reverse_flag, check_flag, t);
+   else
+      return dist_sort<char *>(name, total, op, reverse_flag, check_flag, t);
+}
+
+// ############################################################################
+
+// Fixed-length binary records (--record=SIZE [--key=LEN]), such as the
+// 100-byte records with a 10-byte key written by gensort. The key is at the
+// start of each record and compared by unsigned bytes. Only (key, index)
+// pairs are sorted, the key packed 8 bytes at a time into an integer; the
+// records are permuted once, while writing the output. Equal keys keep the
+// order of the input.
+
+#define RECORD_KEY    10         // default key length, as with gensort
+#define RECORD_SMALL  64         // pairs, sorted by comparison below this
+#define RECORD_MIN    65536      // records per thread, to sort in parallel
+
+struct record_opts {
+   size_t size, key;
+};
+
+struct record_pair {
+   uint64_t key, idx;
+};
+
+// Key bytes [depth, depth + 8) of the record at r, as a big-endian integer
+// with the bytes past the key zero. Loads may read up to 7 bytes past the
+// record; the text is padded by SPACE_PAD for that.
+
+static inline uint64_t
+record_key(const char *r, size_t klen, size_t depth)
+{
+   uint64_t x;
+
+   memcpy(&x, r + depth, 8);
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+   x = __builtin_bswap64(x);
+#endif
+
+   if (klen - depth < 8)
+      x &= ~0ULL << (64 - 8 * (klen - depth));
+
+   return x;
+}
+
+// LSD radix sort of n pairs by the low bytes of their keys, skipping bytes
+// that all keys share. The histograms of all bytes are taken in one pass.
+// Pairs move between p and t; returns the one holding the result.
+
+static record_pair *
+record_lsd(record_pair *p, record_pair *t, size_t n, int bytes)
+{
+   size_t count[8][256], pos[256], i, sum;
+   int b, c;
+
+   memset(count, 0, sizeof(count));
+
+   for (i = 0; i < n; i++)
+      for (b = 0; b < bytes; b++) count[b][(p[i].key >> (8 * b)) & 0xff]++;
+
+   for (b = 0; b < bytes; b++) {
+      if (count[b][(p[0].key >> (8 * b)) & 0xff] == n)
+         continue;
+
+      for (c = 0, sum = 0; c < 256; c++) {
+         pos[c] = sum; sum += count[b][c];
+      }
+
+      for (i = 0; i < n; i++)
+         t[pos[(p[i].key >> (8 * b)) & 0xff]++] = p[i];
+
+      std::swap(p, t);
+   }
+
+   return p;
+}
+
+// Sort the n pairs at p by key bytes [depth, ro->key), the first 8 of which
+// are packed into the pairs and differ in their low bytes only. t is the
+// buffer, of the same size. The result is left in p.
+
+static void
+record_sort(const char *text, const record_opts *ro, record_pair *p,
+            record_pair *t, size_t n, size_t depth, int bytes)
+{
+   record_pair *r;
+   size_t i, j, k;
+
+   if (n < RECORD_SMALL)
+      std::sort(p, p + n, [](const record_pair &x, const record_pair &y) {
+         return x.key < y.key || (x.key == y.key && x.idx < y.idx);
+      });
+   else if ((r = record_lsd(p, t, n, bytes)) != p)
+      memcpy(p, r, sizeof(record_pair) * n);
+
+   if (depth + 8 >= ro->key)
+      return;
+
+   // Runs of equal keys so far are ordered by the next 8 bytes
+   for (i = 0; i < n; i = j) {
+      for (j = i + 1; j < n && p[j].key == p[i].key; j++) ;
+      if (j - i < 2) continue;
+
+      for (k = i; k < j; k++)
+         p[k].key = record_key(text + p[k].idx * ro->size, ro->key, depth + 8);
+
+      record_sort(text, ro, p + i, t + i, j - i, depth + 8, 8);
+   }
+}
+
+// Pack the keys of records [lo, hi) into p and count their first bytes
+static void
+record_pack(const char *text, const record_opts *ro, record_pair *p,
+            size_t lo, size_t hi, size_t *counts)
+{
+   for (; lo < hi; lo++) {
+      p[lo].key = record_key(text + lo * ro->size, ro->key, 0);
+      p[lo].idx = lo;
+      counts[p[lo].key >> 56]++;
+   }
+}
+
+// Sort the n records of text, using the pairs at p and t. The first key
+// byte is distributed by an MSD pass from p into t, each thread moving its
+// share of the pairs. The buckets are then taken by the threads, one at a
+// time, and sorted by an LSD radix sort on the remaining bytes. Returns the
+// array holding the sorted pairs, which is t.
+
+static record_pair *
+record_sort_main(const char *text, const record_opts *ro, record_pair *p,
+                 record_pair *t, size_t n, double *pack_t)
+{
+   std::chrono::steady_clock::time_point start = STOPWATCH_BEGIN();
+   std::vector<std::thread> threads;
+   std::atomic<size_t> next(0);
+   size_t nt = n_threads, i, c, sum;
+
+   if (nt > n / RECORD_MIN) nt = n / RECORD_MIN;
+   if (nt < 1) nt = 1;
+
+   std::vector<size_t> counts(nt * 256, 0), bucket(257, 0);
+
+   for (i = 0; i < nt; i++)
+      threads.push_back(std::thread([=, &counts]() {
+         record_pack(text, ro, p, n * i / nt, n * (i + 1) / nt,
+            &counts[i * 256]);
+      }));
+
+   for (auto &th : threads)
+      th.join();
+
+   threads.clear();
+   *pack_t = STOPWATCH_END(start);
+
+   // Thread i moves its pairs of bucket c after those of threads below i
+   for (c = 0, sum = 0; c < 256; c++) {
+      bucket[c] = sum;
+      for (i = 0; i < nt; i++) {
+         size_t k = counts[i * 256 + c];
+         counts[i * 256 + c] = sum;  sum += k;
+      }
+   }
+
+   bucket[256] = n;
+
+   for (i = 0; i < nt; i++)
+      threads.push_back(std::thread([=, &counts]() {
+         size_t *pos = &counts[i * 256], j;
+
+         for (j = n * i / nt; j < n * (i + 1) / nt; j++)
+            t[pos[p[j].key >> 56]++] = p[j];
+      }));
+
+   for (auto &th : threads)
+      th.join();
+
+   threads.clear();
+
+   for (i = 0; i < nt; i++)
+      threads.push_back(std::thread([=, &next, &bucket]() {
+         size_t b;
+
+         while ((b = next++) < 256) {
+            if (bucket[b + 1] - bucket[b] > 1)
+               record_sort(text, ro, t + bucket[b], p + bucket[b],
+                  bucket[b + 1] - bucket[b], 0, 7);
+         }
+      }));
+
+   for (auto &th : threads)
+      th.join();
+
+   return t;
+}
+
+// Write the records in the order of the pairs, reversed with -r
+static void
+output_records(char *name, int fd, const char *text, size_t rsize,
+               const record_pair *p, size_t n, int reverse_flag)
+{
+   size_t i, j = 0, k, pre = 16;
+   const char *r;
+
+   for (i = 0; i < n; i++) {
+      k = reverse_flag ? n - 1 - i : i;
+      r = text + p[k].idx * rsize;
+
+      // The records are read in random order, fetch some ahead
+      if (i + pre < n)
+         __builtin_prefetch(text + p[reverse_flag ? k - pre : k + pre].idx
+            * rsize);
+
+      if (j + rsize > sizeof(output_buf)) {
+         if ((size_t)write(fd, output_buf, j) != j) {
+            fprintf(stderr, "%s: Could not write to output stream\n", name);
+            return;
+         }
+         j = 0;
+      }
+
+      if (rsize > sizeof(output_buf)) {
+         if ((size_t)write(fd, r, rsize) != rsize) {
+            fprintf(stderr, "%s: Could not write to output stream\n", name);
+            return;
+         }
+         continue;
+      }
+
+      memcpy(output_buf + j, r, rsize);  j += rsize;
+   }
+
+   if (j > 0 && (size_t)write(fd, output_buf, j) != j)
+      fprintf(stderr, "%s: Could not write to output stream\n", name);
+}
+
+static int
+record_main(char *name, FILE *fp, size_t size, record_opts *ro, FILE *op,
+            int reverse_flag, int check_flag, timings *t)
+{
+   std::chrono::steady_clock::time_point start;
+   size_t n = size / ro->size, i, pos, len;
+   record_pair *p, *q, *sorted;
+   int fd = fileno(fp), check_status = 0;
+   char *text;
+   ssize_t r;
+
+   // Load file into memory
+   start = STOPWATCH_BEGIN();
+
+   p = q = NULL;
+
+   if ((text = (char *)arena_alloc(ARENA_TEXT, size + SPACE_PAD)) == NULL ||
+         (p = (record_pair *)arena_alloc(ARENA_PAIRS,
+            sizeof(record_pair) * (n + 1))) == NULL ||
+         (q = (record_pair *)arena_alloc(ARENA_PAIRS + 1,
+            sizeof(record_pair) * (n + 1))) == NULL) {
+      fprintf(stderr, "%s: Could not allocate memory for records\n", name);
+      goto fail;
+   }
+
+   memset(text + size, 0, SPACE_PAD);
+   posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+
+   for (pos = 0; pos < size; pos += r) {
+      len = (size - pos < BLOCK_SIZE) ? size - pos : BLOCK_SIZE;
+
+      if ((r = read(fd, text + pos, len)) <= 0) {
+         fprintf(stderr, "%s: Could not read the records\n", name);
+         goto fail;
+      }
+   }
+
+   fclose(fp);
+
+   t->load_t = STOPWATCH_END(start);
+   t->bytes = size;  t->lines = n;  t->check_t = 0.0;
+
+   // Pack the keys, then sort the pairs
+   start = STOPWATCH_BEGIN();
+   sorted = (n > 0) ? record_sort_main(text, ro, p, q, n, &t->ptrary_t) : p;
+   t->sort_t = STOPWATCH_END(start);
+   t->sort_t -= t->ptrary_t;
+
+   // Check sorted
+   if (check_flag) {
+      start = STOPWATCH_BEGIN();
+
+      for (i = 1; i < n; i++) {
+         if (memcmp(text + sorted[i - 1].idx * ro->size,
+               text + sorted[i].idx * ro->size, ro->key) > 0) {
+            check_status = 1; break;
+         }
+      }
+
+      t->check_t = STOPWATCH_END(start);
+   }
+
+   // Output sorted, permuting the records
+   start = STOPWATCH_BEGIN();
+
+   if (op != NULL) {
+      output_records(name, fileno(op), text, ro->size, sorted, n,
+         reverse_flag);
+
+      if (op != stdout) fclose(op);
+   }
+
+   t->save_t = STOPWATCH_END(start);
+
+   // Free memory
+   start = STOPWATCH_BEGIN();
+   arena_free(ARENA_PAIRS, p); arena_free(ARENA_PAIRS + 1, q);
+   arena_free(ARENA_TEXT, text);
+   t->free_t = STOPWATCH_END(start);
+
+   return check_status;
+
+fail:
+   arena_free(ARENA_PAIRS, p); arena_free(ARENA_PAIRS + 1, q);
+   arena_free(ARENA_TEXT, text);
+
+   fclose(fp);
+   if (op != NULL && op != stdout) fclose(op);
+   return -1;
+}
+
+// ############################################################################
+
+static FILE *
+open_output(char *name, char *oname, off_t seek_off)
+{
+   FILE *op = (seek_off < 0) ? fopen(oname, "w") : fopen_at(oname, seek_off);
+
+   if (op == NULL)
+      fprintf(stderr, "%s: Could not open %s for writing\n", name, oname);
+
+   return op;
+}
+
+static void
+report_bm(char *bname, timings *t, int check_status)
+{
+   FILE *bp;
+
+   if (bname != NULL) {
+      bp = fopen(bname, "w");
+
+      output_bm(bp, \
+         t->load_t, t->ptrary_t, t->sort_t, t->check_t, t->save_t, t->free_t,
+         check_status);
+
+      fclose(bp);
+
+   } else {
+      output_bm(stderr, \
+         t->load_t, t->ptrary_t, t->sort_t, t->check_t, t->save_t, t->free_t,
+         check_status);
+   }
+}
+
+// ############################################################################
+
+// Sort server (--serve=PATH), see serve.h. It runs the jobs that clients
+// send with --connect=PATH, taking the other arguments as the binary does.
+// Jobs run one after the other, each with the threads of the server, so
+// that concurrent jobs queue rather than oversubscribe the cores. A job
+// sees the standard streams and working directory of its client. Buffers
+// are kept from one job to the next (keep_arenas).
+
+static int sort_command(int argc, char *argv[]);
+
+static int serving = 0;
+
+static int
+serve_main(char *name, char *path)
+{
+   int lfd, fd, cwd, saved[3], threads = n_threads, i;
+   int32_t status;
+   serve_job job;
+
+   if (!dist_is_unix(path)) {
+      fprintf(stderr, "%s: --serve takes a path with a slash, such as "
+         "./sort.sock\n", name);
+      return 1;
+   }
+   if ((lfd = dist_socket(path, 1)) < 0) {
+      fprintf(stderr, "%s: Could not listen on %s\n", name, path);
+      return 1;
+   }
+
+   // Clients may go away while their output is written
+   signal(SIGPIPE, SIG_IGN);
+
+   for (i = 0; i < 3; i++)
+      saved[i] = dup(i);
+
+   cwd = open(".", O_RDONLY | O_DIRECTORY);
+   keep_arenas = 1;  serving = 1;
+
+   for (;;) {
+      // Only a broken listening socket ends the server
+      if ((fd = accept4(lfd, NULL, NULL, SOCK_CLOEXEC)) < 0) {
+         if (errno == EBADF || errno == EINVAL || errno == ENOTSOCK)
+            break;
+         if (errno == EMFILE || errno == ENFILE)
+            usleep(100000);
+         continue;
+      }
+      if (serve_recv_job(fd, &job) != 0) {
+         close(fd); continue;
+      }
+
+      for (i = 0; i < 3; i++)
+         dup2(job.fd[i], i);
+
+      if (job.argc < 1 || chdir(job.cwd) != 0) {
+         fprintf(stderr, "%s: Could not change to %s\n", name, job.cwd);
+         status = 1;
+      } else {
+         n_threads = threads;  optind = 0;
+         status = sort_command(job.argc, job.argv);
+      }
+
+      // Restore the server's streams, directory and locale
+      fflush(stdout); fflush(stderr);
+
+      for (i = 0; i < 3; i++)
+         dup2(saved[i], i);
+
+      if (fchdir(cwd) != 0 || setlocale(LC_ALL, "C") == NULL)
+         fprintf(stderr, "%s: Could not restore the server\n", name);
+
+      serve_free_job(&job);
+
+      dist_write(fd, &status, sizeof(status));
+      close(fd);
+   }
+
+   close(lfd); unlink(path);
+   return 1;
+}
+
+// Send the job to the server at path, without --connect, and wait for it.
+// Returns the exit status of the job.
+
+static int
+connect_main(char *name, char *path, int argc, char *argv[])
+{
+   std::vector<char *> args;
+   char cwd[4096];
+   int32_t status;
+   size_t len;
+   int fd, i;
+
+   // --connect=path or --connect path, possibly abbreviated
+   for (i = 0; i < argc; i++) {
+      len = strcspn(argv[i], "=");
+
+      if (i > 0 && len > 4 && strncmp(argv[i], "--connect", len) == 0) {
+         if (argv[i][len] == '\0') i++;
+         continue;
+      }
+
+      args.push_back(argv[i]);
+   }
+
+   if (getcwd(cwd, sizeof(cwd)) == NULL) {
+      fprintf(stderr, "%s: Could not get the working directory\n", name);
+      return 1;
+   }
+   if ((fd = dist_socket(path, 0)) < 0) {
+      fprintf(stderr, "%s: Could not connect to %s\n", name, path);
+      return 1;
+   }
+
+   if (serve_send_job(fd, cwd, args.size(), args.data()) != 0 ||
+         dist_read(fd, &status, sizeof(status)) != 0) {
+      fprintf(stderr, "%s: The server at %s did not complete the job\n",
+         name, path);
+      close(fd); return 1;
+   }
+
+   close(fd);
+   return status;
+}
+
+// ############################################################################
+
+static int
+sort_command(int argc, char *argv[])
+{
+   timings t = {};
+
+   int opt, reverse_flag = 0, check_status = 0;
+   int bm_flag = 0, bm_out_flag = 0, check_flag = 0, no_output_flag = 0;
+   int seek_flag = 0, threads_flag = 0, index_flag = 0, index_seek_flag = 0;
+   int merge_flag = 0, delta_flag = 0, rank_flag = 0, peers_flag = 0;
+   int dist_rank = 0, trace_flag = 0, trace_worker_flag = 0, trace_worker = -1;
+   char *bname = NULL, *fname = NULL, *oname = NULL, *dname = NULL;
+   char *peers = NULL, *tname = NULL, *locale = NULL;
+   char *sname = NULL, *cname = NULL;
+   off_t seek_off = -1;
+   index_opts ix = { NULL, 0, 0, -1 };
+   collate_opts co = {};
+   record_opts ro = { 0, 0 };
+   int locale_flag = 0, record_flag = 0, key_flag = 0, c;
+   int serve_flag = 0, connect_flag = 0;
+   FILE *fp, *op;
+   size_t size;
+
+   struct option longopts[] = {
+      { "bm",         no_argument,        &bm_flag,         1 },
+      { "bm-out",     required_argument,  &bm_out_flag,     1 },
+      { "check",      no_argument,        &check_flag,      1 },
+      { "no-output",  no_argument,        &no_output_flag,  1 },
+      { "seek",       required_argument,  &seek_flag,       1 },
+      { "threads",    required_argument,  &threads_flag,    1 },
+      { "index",      required_argument,  &index_flag,      1 },
+      { "index-lcp",  no_argument,        &ix.lcp_flag,     1 },
+      { "index-seek", required_argument,  &index_seek_flag, 1 },
+      { "index-tags", no_argument,        &ix.tags_flag,    1 },
+      { "merge",      no_argument,        &merge_flag,      1 },
+      { "delta",      required_argument,  &delta_flag,      1 },
+      { "dist-rank",  required_argument,  &rank_flag,       1 },
+      { "dist-peers", required_argument,  &peers_flag,      1 },
+      { "trace",      required_argument,  &trace_flag,      1 },
+      { "trace-worker", required_argument, &trace_worker_flag, 1 },
+      { "ignore-case", no_argument,       &co.fold_flag,    1 },
+      { "locale",     required_argument,  &locale_flag,     1 },
+      { "record",     required_argument,  &record_flag,     1 },
+      { "key",        required_argument,  &key_flag,        1 },
+      { "serve",      required_argument,  &serve_flag,      1 },
+      { "connect",    required_argument,  &connect_flag,    1 },
+      { NULL,         0,                  NULL,             0 }
+   };
+
+   // Parse command-line arguments
+   while ((opt = getopt_long(argc, argv, "rfo:", longopts, NULL)) != -1) {
+      switch (opt) {
+         case 'r':
+            reverse_flag = 1;
+            break;
+         case 'f':
+            co.fold_flag = 1;
+            break;
+         case 'o':
+            oname = optarg;
+            break;
+         case 0:
+            if (bm_out_flag) {
+               bm_out_flag = 0;
+               bname = optarg;
+            }
+            if (seek_flag) {
+               seek_flag = 0;
+               seek_off = strtoll(optarg, NULL, 10);
+            }
+            if (threads_flag) {
+               threads_flag = 0;
+               n_threads = atoi(optarg);
+               if (n_threads <= 0)
+                  n_threads = std::thread::hardware_concurrency();
+               if (n_threads <= 0)
+                  n_threads = 1;
+            }
+            if (index_flag) {
+               index_flag = 0;
+               ix.name = optarg;
+            }
+            if (index_seek_flag) {
+               index_seek_flag = 0;
+               ix.seek = strtoll(optarg, NULL, 10);
+            }
+            if (delta_flag) {
+               delta_flag = 0;
+               dname = optarg;
+            }
+            if (rank_flag) {
+               rank_flag = 0;
+               dist_rank = atoi(optarg);
+            }
+            if (peers_flag) {
+               peers_flag = 0;
+               peers = optarg;
+            }
+            if (trace_flag) {
+               trace_flag = 0;
+               tname = optarg;
+            }
+            if (trace_worker_flag) {
+               trace_worker_flag = 0;
+               trace_worker = atoi(optarg);
+            }
+            if (locale_flag) {
+               locale_flag = 0;
+               locale = optarg;
+            }
+            if (record_flag) {
+               record_flag = 0;
+               if ((ro.size = strtoull(optarg, NULL, 10)) == 0) {
+                  fprintf(stderr, "%s: invalid record size %s\n", argv[0],
+                     optarg);
+                  return 1;
+               }
+            }
+            if (serve_flag) {
+               serve_flag = 0;
+               sname = optarg;
+            }
+            if (connect_flag) {
+               connect_flag = 0;
+               cname = optarg;
+            }
+            if (key_flag) {
+               key_flag = 0;
+               if ((ro.key = strtoull(optarg, NULL, 10)) == 0) {
+                  fprintf(stderr, "%s: invalid key length %s\n", argv[0],
+                     optarg);
+                  return 1;
+               }
+            }
+            break;
+         default:
+            fprintf(stderr, "usage: %s [-r] file [-o output]\n", argv[0]);
+            return 1;
+      }
+   }
+
+   // Run as a server, or have one run the job
+   if (sname != NULL || cname != NULL) {
+      if (serving) {
+         fprintf(stderr, "%s: --serve and --connect are not supported in "
+            "jobs\n", argv[0]);
+         return 1;
+      }
+
+      return (sname != NULL) ? serve_main(argv[0], sname)
+                             : connect_main(argv[0], cname, argc, argv);
+   }
+
+   if (optind >= argc) {
+      fprintf(stderr, "%s: missing file, ", argv[0]);
+      fprintf(stderr, "usage: %s [-r] file [-o sorted]\n", argv[0]);
+      return 1;
+   }
+
+   if (serving && (merge_flag || dname != NULL || peers != NULL)) {
+      fprintf(stderr, "%s: --merge, --delta and --dist-peers are not "
+         "supported by the server\n", argv[0]);
+      return 1;
+   }
+
+   if ((merge_flag || dname != NULL || peers != NULL) && ix.name != NULL) {
+      fprintf(stderr, "%s: --index is only supported for a single file\n",
+         argv[0]);
+      return 1;
+   }
+
+   // Collation, by upper case with -f, and by the locale's rules unless it
+   // is C or POSIX
+   if (co.fold_flag || locale != NULL) {
+      if (merge_flag || dname != NULL || peers != NULL || ix.name != NULL) {
+         fprintf(stderr, "%s: -f and --locale are only supported for a single "
+            "file without --index\n", argv[0]);
+         return 1;
+      }
+      if (locale != NULL && setlocale(LC_ALL, locale) == NULL) {
+         fprintf(stderr, "%s: unknown locale %s\n", argv[0], locale);
+         return 1;
+      }
+      if (locale != NULL) {
+         char *lc = setlocale(LC_COLLATE, NULL);
+         co.xfrm_flag = strcmp(lc, "C") != 0 && strcmp(lc, "POSIX") != 0;
+      }
+      for (c = 0; c < 256; c++)
+         co.fold[c] = co.fold_flag ? toupper(c) : c;
+   }
+
+   // Fixed-length records, keyed by their first --key bytes
+   if (ro.size > 0) {
+      if (merge_flag || dname != NULL || peers != NULL || ix.name != NULL ||
+            co.fold_flag || locale != NULL) {
+         fprintf(stderr, "%s: --record is only supported for a single file "
+            "without --index, -f or --locale\n", argv[0]);
+         return 1;
+      }
+      if (ro.key == 0)
+         ro.key = (ro.size < RECORD_KEY) ? ro.size : RECORD_KEY;
+      if (ro.key > ro.size) {
+         fprintf(stderr, "%s: the key is longer than the record\n", argv[0]);
+         return 1;
+      }
+   }
+   else if (ro.key > 0) {
+      fprintf(stderr, "%s: --key requires --record\n", argv[0]);
+      return 1;
+   }
+
+   t.start = wall_time();
+
+   // Sort the file together with the processes listed in --dist-peers
+   if (peers != NULL) {
+      check_status = dist_main(argv[0], argv[optind], dist_rank, peers, oname,
+         seek_off, no_output_flag, reverse_flag, check_flag, &t);
+
+      if (bm_flag)
+         report_bm(bname, &t, check_status);
+      if (tname != NULL)
+         output_trace(argv[0], tname, trace_worker, argv[optind], &t);
+
+      return 0;
+   }
+
+   // Merge the files given, or the file sorted here into --delta
+   if (merge_flag || dname != NULL) {
+      char *fnames[2];
+
+      if (no_output_flag) op = NULL;
+      else if (oname == NULL) op = stdout;
+      else if ((op = open_output(argv[0], oname, seek_off)) == NULL) return 1;
+
+      if (dname != NULL) {
+         fnames[0] = dname;  fnames[1] = argv[optind];
+         check_status = merge_main(argv[0], 2, fnames, 1, op,
+            reverse_flag, check_flag, &t);
+      } else {
+         check_status = merge_main(argv[0], argc - optind, argv + optind, 0,
+            op, reverse_flag, check_flag, &t);
+      }
+
+      if (bm_flag)
+         report_bm(bname, &t, check_status);
+      if (tname != NULL)
+         output_trace(argv[0], tname, trace_worker, argv[optind], &t);
+
+      return 0;
+   }
+
+   fname = argv[optind];
+
+   // =========================================================================
+
+   // Error checking, - being the standard input
+   if ((fp = (strcmp(fname, "-") == 0)
+         ? fdopen(dup(0), "r") : fopen(fname, "r")) == NULL) {
+      fprintf(stderr, "%s: Could not open %s for reading\n", argv[0], fname);
+      return 1;
+   }
+   if ((size = get_size(fileno(fp))) == -1) {
+      fprintf(stderr, "%s: %s is not a regular file\n", argv[0], fname);
+      fclose(fp); return 1;
+   }
+   if (ro.size > 0 && size % ro.size != 0) {
+      fprintf(stderr, "%s: The size of %s is not a multiple of %zu\n",
+         argv[0], fname, ro.size);
+      fclose(fp); return 1;
+   }
+   if (size == 0 && (ix.name == NULL || ix.seek >= 0)) {
+      fclose(fp); return 0;
+   }
+
+   if (oname != NULL && no_output_flag == 0 &&
+         (op = open_output(argv[0], oname, seek_off)) == NULL) {
+      fclose(fp); return 1;
+   }
+
+   // =========================================================================
+
+   if (no_output_flag) op = NULL;
+   else if (oname == NULL) op = stdout;
+
+   // Sort the records of the file
+   if (ro.size > 0) {
+      check_status = record_main(argv[0], fp, size, &ro, op, reverse_flag,
+         check_flag, &t);
+
+      if (check_status < 0)
+         return 1;
+
+      if (bm_flag)
+         report_bm(bname, &t, check_status);
+      if (tname != NULL)
+         output_trace(argv[0], tname, trace_worker, fname, &t);
+
+      return 0;
+   }
+
+   // Pointer arrays hold 32-bit offsets when the file is small enough
+   if (size <= UINT32_MAX)
+      check_status = sort_file<offset_t>(argv[0], fp, size, op,
+         ix.name ? &ix : NULL, (co.fold_flag || co.xfrm_flag) ? &co : NULL,
+         reverse_flag, check_flag, &t);
+   else
+      check_status = sort_file<char *>(argv[0], fp, size, op,
+         ix.name ? &ix : NULL, (co.fold_flag || co.xfrm_flag) ? &co : NULL,
+         reverse_flag, check_flag, &t);
+
+   if (check_status < 0)
+      return 1;
+
+   // =========================================================================
+
+   if (bm_flag)
+      report_bm(bname, &t, check_status);
+   if (tname != NULL)
+      output_trace(argv[0], tname, trace_worker, fname, &t);
+
+   return 0;
+}
+
+int main(int argc, char *argv[])
+{
+   return sort_command(argc, argv);
+}
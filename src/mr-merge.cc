@@ -17,18 +17,17 @@ namespace mr_merge {
 
 size_t depth = 0;
 
+template <typename S>
 static inline void
-inssort(char **str, size_t n, size_t d)
+inssort(S *str, size_t n, size_t d)
 {
-    char **pj, *s, *t;
+    S *pj;
 
-    for (char **pi = str + 1; --n > 0; pi++) {
-        char *tmp = *pi;
+    for (S *pi = str + 1; --n > 0; pi++) {
+        S tmp = *pi;
 
         for (pj = pi; pj > str; pj--) {
-            for (s = *(pj-1)+d, t = tmp+d; *s == *t && *s != 0; ++s, ++t)
-                ;
-            if (*s <= *t)
+            if (scmp(str_of(*(pj-1))+d, str_of(tmp)+d) <= 0)
                 break;
             *pj = *(pj-1);
         }
@@ -36,10 +35,11 @@ inssort(char **str, size_t n, size_t d)
     }
 }
 
+template <typename S>
 static void
-xmerge(char **a, char **b, size_t L, size_t N, size_t M)
+xmerge(S *a, S *b, size_t L, size_t N, size_t M)
 {
-   size_t i, j, k, r; char *s, *t;
+   size_t i, j, k, r;
 
    i = L;  j = i + N;  r = j + M;
    M += L + N;  N += L;
@@ -48,15 +48,14 @@ xmerge(char **a, char **b, size_t L, size_t N, size_t M)
       if (i == N) { a[k] = b[j++]; continue; }
       if (j == M) { a[k] = b[i++]; continue; }
 
-      s = b[i] + depth;  t = b[j] + depth;
-      for (; *s == *t && *s != 0; s++, t++) ;
-
-      a[k] = (*s < *t) ? b[i++] : b[j++];
+      a[k] = (scmp(str_of(b[i]) + depth, str_of(b[j]) + depth) < 0)
+           ? b[i++] : b[j++];
    }
 }
 
+template <typename S>
 static void
-xmergesort(char **a, char **b, size_t L, size_t R)
+xmergesort(S *a, S *b, size_t L, size_t R)
 {
    size_t m;
 
@@ -73,17 +72,18 @@ xmergesort(char **a, char **b, size_t L, size_t R)
    xmerge(a, b, L, m - L + 1, R - m);
 }
 
+template <typename S>
 static void
-mergesort(char **a, size_t n)
+mergesort(S *a, size_t n)
 {
-   char **aux;
+   S *aux;
 
-   if ((aux = (char **)malloc(sizeof(size_t) * (n + 1))) == NULL) {
+   if ((aux = (S *)malloc(sizeof(S) * (n + 1))) == NULL) {
       fprintf(stderr, "Could not allocate aux ptr array\n");
       exit(1);
    }
 
-   memcpy(aux, a, sizeof(size_t) * n);
+   memcpy(aux, a, sizeof(S) * n);
    xmergesort(a, aux, 0, n - 1);
 
    free((void*) aux);
@@ -96,3 +96,8 @@ void sort_main(char **a, size_t n)
    mr_merge::mergesort(a, n);
 }
 
+void sort_main(offset_t *a, size_t n)
+{
+   mr_merge::mergesort(a, n);
+}
+
@@ -0,0 +1,198 @@
+/*
+ * Out-of-place MSD radix distribution for large inputs (tr-radix, tb-radix).
+ *
+ * The cycle leader swaps of an in-place distribution wait on the load of
+ * each destination before the next move, which leaves little memory-level
+ * parallelism once the array no longer fits in the last-level cache. Here
+ * the strings are scattered into a buffer of the same size instead. Each
+ * bucket is staged in a cache line of its own, written out with
+ * non-temporal stores once full. The first line of a bucket is only filled
+ * up to a 64-byte boundary and written with plain stores, so that every
+ * streamed line is whole and aligned. The histogram is counted in four
+ * sub-counters, so that a run of equal characters does not wait on the
+ * store of the previous increment. Levels alternate between the array and
+ * the buffer. Buckets that fit in the cache go to the in-place sort of the
+ * kernel.
+ *
+ * The code presented in this file has been tested with care but is not
+ * guaranteed for any purpose. The writer does not offer any warranties
+ * nor does he accept any liabilities with respect to the code.
+ */
+
+#ifndef MSD_OOP_H
+#define MSD_OOP_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+static const size_t WC_BYTES = 64;
+
+// State shared by all levels, allocated once. A level is done with it
+// before its buckets are sorted.
+
+template <typename S>
+struct oop_scratch {
+    void (*small)(S*, size_t, size_t, const size_t*);
+    size_t min;                   // buckets below this go to small()
+    uint8_t* oracle;              // characters of the current level
+    size_t sub[4][128];
+    unsigned wcn[128], wcap[128];
+    alignas(64) S wc[128][WC_BYTES / sizeof(S)];
+};
+
+static inline void
+stream_store(uint32_t* p, uint32_t v)
+{
+#ifdef __SSE2__
+    _mm_stream_si32((int*) p, (int) v);
+#else
+    *p = v;
+#endif
+}
+
+static inline void
+stream_store(char** p, char* v)
+{
+#if defined(__SSE2__) && defined(__x86_64__)
+    _mm_stream_si64((long long*) p, (long long) v);
+#else
+    *p = v;
+#endif
+}
+
+// Sorts the strings in from, using to as the buffer. The result is left in
+// to when in_to is set.
+
+template <typename S>
+static void
+msd_oop(S* from, S* to, size_t n, size_t depth, bool in_to,
+        oop_scratch<S>* ws, const size_t* counts = NULL)
+{
+    const size_t W = WC_BYTES / sizeof(S);
+    size_t bucketsize[128], bucketindex[128], i;
+    uint8_t* restrict oracle = ws->oracle;
+    S (*wc)[W] = ws->wc;
+    unsigned* wcn = ws->wcn;
+    unsigned* wcap = ws->wcap;
+
+    // All in one bucket, as for a common prefix, moves nothing: go on with
+    // the next character
+    for (;; ++depth, counts = NULL) {
+        if (n < ws->min) {
+            ws->small(from, n, depth, counts);
+            if (in_to) memcpy(to, from, sizeof(S) * n);
+            return;
+        }
+        if (counts) {
+            for (i=0; i < n; ++i)
+                oracle[i] = str_of(from[i])[depth];
+            memcpy(bucketsize, counts, sizeof(bucketsize));
+        } else {
+            size_t (*sub)[128] = ws->sub;
+            memset(sub, 0, sizeof(ws->sub));
+            for (i=0; i + 4 <= n; i += 4) {
+                uint8_t c0 = str_of(from[i])[depth];
+                uint8_t c1 = str_of(from[i+1])[depth];
+                uint8_t c2 = str_of(from[i+2])[depth];
+                uint8_t c3 = str_of(from[i+3])[depth];
+                oracle[i] = c0; oracle[i+1] = c1;
+                oracle[i+2] = c2; oracle[i+3] = c3;
+                ++sub[0][c0]; ++sub[1][c1]; ++sub[2][c2]; ++sub[3][c3];
+            }
+            for (; i < n; ++i)
+                ++sub[0][oracle[i] = str_of(from[i])[depth]];
+            for (unsigned c=0; c < 128; ++c)
+                bucketsize[c] = sub[0][c] + sub[1][c] + sub[2][c] + sub[3][c];
+        }
+        if (bucketsize[oracle[0]] != n)
+            break;
+        if (oracle[0] == 0) {
+            if (in_to) memcpy(to, from, sizeof(S) * n);
+            return;
+        }
+    }
+
+    // The first line of a bucket takes the strings up to the next cache
+    // line boundary of its place in to
+    bucketindex[0] = 0;
+    for (unsigned c=1; c < 128; ++c)
+        bucketindex[c] = bucketindex[c-1] + bucketsize[c-1];
+    for (unsigned c=0; c < 128; ++c) {
+        size_t head = (-(uintptr_t) (to + bucketindex[c]) % WC_BYTES)
+                    / sizeof(S);
+        wcn[c] = 0;
+        wcap[c] = head ? head : W;
+    }
+    for (i=0; i < n; ++i) {
+        uint8_t c = oracle[i];
+        wc[c][wcn[c]++] = from[i];
+        if (wcn[c] == wcap[c]) {
+            S* dst = to + bucketindex[c];
+            if (wcap[c] == W)
+                for (unsigned k=0; k < W; ++k)
+                    stream_store(dst + k, wc[c][k]);
+            else
+                memcpy(dst, wc[c], sizeof(S) * wcn[c]);
+            bucketindex[c] += wcn[c];
+            wcn[c] = 0;
+            wcap[c] = W;
+        }
+    }
+    for (unsigned c=0; c < 128; ++c)
+        memcpy(to + bucketindex[c], wc[c], sizeof(S) * wcn[c]);
+#ifdef __SSE2__
+    _mm_sfence();
+#endif
+    // The buckets are in to now, and sorted where they belong: in from
+    // unless in_to is set
+    if (!in_to)
+        memcpy(from, to, sizeof(S) * bucketsize[0]);
+    size_t bsum = bucketsize[0];
+    for (unsigned c=1; c < 128; ++c) {
+        if (bucketsize[c] == 0) continue;
+        msd_oop(to+bsum, from+bsum, bucketsize[c], depth+1, !in_to, ws);
+        bsum += bucketsize[c];
+    }
+}
+
+// Sorts with msd_oop when the array exceeds the last-level cache and memory
+// for the buffer can be had, with small() otherwise and for the buckets
+// that fit in the cache.
+
+template <typename S>
+static void
+msd_oop_sort(S* strings, size_t n, const size_t* counts,
+             void (*small)(S*, size_t, size_t, const size_t*))
+{
+    long llc = sysconf(_SC_LEVEL3_CACHE_SIZE);
+    if (llc <= 0) llc = sysconf(_SC_LEVEL2_CACHE_SIZE);
+    if (llc <= 0) llc = 8 << 20;
+    size_t min = std::max((size_t) llc / sizeof(S), (size_t) 1 << 16);
+    if (n < min) {
+        small(strings, n, 0, counts);
+        return;
+    }
+    S* buf = (S*) malloc(sizeof(S) * n);
+    uint8_t* oracle = (uint8_t*) malloc(n);
+    void* ws = NULL;
+    if (buf == NULL || oracle == NULL ||
+            posix_memalign(&ws, WC_BYTES, sizeof(oop_scratch<S>)) != 0) {
+        free(buf); free(oracle);
+        small(strings, n, 0, counts);
+        return;
+    }
+    oop_scratch<S>* s = (oop_scratch<S>*) ws;
+    s->small = small; s->min = min; s->oracle = oracle;
+    msd_oop(strings, buf, n, 0, false, s, counts);
+    free(ws); free(oracle); free(buf);
+}
+
+#endif
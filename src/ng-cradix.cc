@@ -57,6 +57,9 @@
  */
 
 #include "main.h"
+#include <algorithm>
+#include <cmath>
+#include <vector>
 
 namespace ng_cradix {
 
@@ -65,64 +68,68 @@ typedef char BYTE, *LPBYTE, **LPPBYTE;
 typedef char STR, *LPSTR, **LPPSTR, **STRPARR;
 
 static const UINT AS  = 128;     /* Alphabet size */
-static const UINT BS  = 4;       /* key buffer size */
 static const UINT AL  = 0;       /* Alphabet lower bound */
 static const UINT AH  = 127;     /* Alphabet upper bound */
 static const UINT IC  = 20;      /* Insertion sort cut off */
 static const UINT KBC = 128;     /* Cache cut off */
-static const UINT SS  = 4096;    /* stack size */
+static const UINT SN  = 1024;    /* LCP sample size */
 
-#define push(a, k, n, b) sp->sa = a, sp->sk = k, sp->sn = n, (sp++)->sb = b
-#define pop(a, k, n, b) a = (--sp)->sa, k = sp->sk, n = sp->sn, b = sp->sb
-#define stackempty() (sp <= stack)
+#define push(a, k, n, b) stack.push_back(Stack<S>{ a, k, n, b })
+#define pop(a, k, n, b) a = stack.back().sa, k = stack.back().sk, \
+   n = stack.back().sn, b = stack.back().sb, stack.pop_back()
+#define stackempty() (stack.empty())
 #define splittable(c) c > 0 && count[c] > IC
 
+template <typename S>
 struct Stack {
-   LPSTR* sa; LPBYTE sk;
+   S* sa; LPBYTE sk;
    UINT sn, sb;
-} stack[SS], *sp=stack;
+};
 
+/*
+ * Key buffers hold BS bytes per string at a fixed stride and are filled and
+ * permuted a whole buffer at a time. Bytes past a terminator are copied too
+ * but never read, as the group of terminated strings is not split further.
+ * The string space is padded by SPACE_PAD, so the loads stay inside it.
+ */
+
+template <UINT BS, typename S>
 static void
-FillKeyBuffer(LPPSTR a, LPBYTE kb, UINT* count, UINT n, UINT d)
+FillKeyBuffer(S* a, LPBYTE kb, UINT* count, UINT n, UINT d)
 {
-   UINT i, j; LPSTR c, x;
-
-   for (i = 0; i < n; i++) {
-      x = a[i] + d; count[*x]++;
+   UINT i; LPSTR x;
 
-      for (j = 0, c = x; *c != 0 && j < BS; j++) {
-         *kb = *c; kb++; c++;
-      }
-      if (j < BS) {
-         *kb = '\0'; kb += BS - j;
-      }
+   for (i = 0; i < n; i++, kb += BS) {
+      x = str_of(a[i]) + d; count[*x]++;
+      memcpy(kb, x, BS);
    }
 }
 
+template <typename S>
 static void
-isort(char **a, UINT n, UINT d)
+isort(S *a, UINT n, UINT d)
 {
-   char **pi, **pj, *s, *t;
+   S *pi, *pj, tmp;
 
    for (pi = a + 1; --n > 0; pi++) {
       for (pj = pi; pj > a; pj--) {
-         for (s = *(pj - 1) + d, t = *pj + d; *s == *t && *s != 0; s++, t++) ;
+         if (scmp(str_of(*(pj - 1)) + d, str_of(*pj) + d) <= 0) break;
 
-         if (*s <= *t) break;
-
-         t = *(pj); *(pj) = *(pj - 1);
-         *(pj - 1) = t;
+         tmp = *(pj); *(pj) = *(pj - 1);
+         *(pj - 1) = tmp;
       }
    }
 }
 
+template <typename S>
 static void
-RDFK(LPPSTR* GrpKP, LPPSTR a, UINT n, LPPSTR ta, UINT* count, UINT d)
+RDFK(S** GrpKP, S* a, UINT n, S* ta, UINT* count, UINT d,
+     std::vector< Stack<S> >& stack)
 {
    /* Read Directly From Keys */
-   LPPSTR ak, tc; UINT i, *cptr, gs; char c = 0;
+   S *ak, *tc; UINT i, *cptr, gs; char c = 0;
 
-   for (i = 0; i < n; i++) count[a[i][d]]++;
+   for (i = 0; i < n; i++) count[str_of(a[i])[d]]++;
 
    cptr = &count[AL]; while (*cptr < 1) cptr++;
 
@@ -140,10 +147,10 @@ RDFK(LPPSTR* GrpKP, LPPSTR a, UINT n, LPPSTR ta, UINT* count, UINT d)
 
    for (ak = a, i = AL; i < AH; i++) GrpKP[i + 1] = ak += count[i];
 
-   memcpy(ta, a, sizeof(LPSTR) * n);
+   memcpy(ta, a, sizeof(S) * n);
 
    for (i = 0, tc = ta; i < n; i++, tc++) {
-      *GrpKP[ta[i][d]] = *tc; GrpKP[ta[i][d]]++;
+      *GrpKP[str_of(ta[i])[d]] = *tc; GrpKP[str_of(ta[i])[d]]++;
    }
 
    for (ak = a, i = AL; i < AH; i++) {
@@ -154,21 +161,23 @@ RDFK(LPPSTR* GrpKP, LPPSTR a, UINT n, LPPSTR ta, UINT* count, UINT d)
    }
 }
 
+template <UINT BS, typename S>
 static void
-CRadix(LPPSTR a, UINT n)
+CRadix(S* a, UINT n)
 {
-   UINT kbsd, kbsd1, i, j, stage, d, MEMSIZE;
+   UINT i, stage, d, MEMSIZE;
    UINT *cptr, gs, count[AS];
-   LPSTR tj, tk, ax, tl, kb, ss, tt, GrpKB[AS];
-   LPPSTR GrpKP[AS], ak, ta, tc, t;
+   LPSTR tj, tk, ax, kb, GrpKB[AS], *t;
+   S *GrpKP[AS], *ak, *ta, *tc;
+   std::vector< Stack<S> > stack;
 
-   if (sizeof(LPPSTR) > sizeof(char) * BS)
-      MEMSIZE = sizeof(LPPSTR);
+   if (sizeof(S) > sizeof(char) * BS)
+      MEMSIZE = sizeof(S);
    else
       MEMSIZE = sizeof(char) * BS;
 
    /* workspace */
-   ta = (LPPSTR)malloc(n * MEMSIZE);
+   ta = (S*)malloc(n * MEMSIZE);
 
    /* memory for key buffers */
    tk = (LPBYTE)malloc(n * sizeof(char) * BS);
@@ -181,13 +190,13 @@ CRadix(LPPSTR a, UINT n)
       if (tk) {
          /* set the counters and fill the key buffers if necessary */
          if ((d = stage % BS) != 0)
-            for (i = 0, tl = tk; i < n; i++, tl += (BS - d))
-               count[*tl]++;
+            for (i = 0, ax = tk + d; i < n; i++, ax += BS)
+               count[*ax]++;
          else {
             if (n > KBC)
-               FillKeyBuffer(a, tk, count, n, stage);
+               FillKeyBuffer<BS>(a, tk, count, n, stage);
             else {
-               RDFK(GrpKP, a, n, ta, count, stage);
+               RDFK(GrpKP, a, n, ta, count, stage, stack);
                continue;
             }
          }
@@ -199,31 +208,25 @@ CRadix(LPPSTR a, UINT n)
          else gs = 0;
 
          /* calculate both key ptr and key buffer addresses */
-         kbsd = BS - d, kbsd1 = kbsd - 1;
          GrpKP[AL] = a; GrpKB[AL] = tk;
 
          for (ak = a, ax = tk, i = AL; i < AH; i++) {
             GrpKP[i+1] = ak += count[i];
-            GrpKB[i+1] = ax += count[i]*kbsd1;
+            GrpKB[i+1] = ax += count[i]*BS;
          }
 
          /* permute the key ptrs */
-         memcpy(ta, a, sizeof(LPSTR)*gs);
+         memcpy(ta, a, sizeof(S)*gs);
 
-         for (i = 0, ax = tk, tc = ta; i < gs; i++, ax += kbsd, tc++) {
+         for (i = 0, ax = tk + d, tc = ta; i < gs; i++, ax += BS, tc++) {
             *GrpKP[*ax] = *tc; GrpKP[*ax]++;
          }
 
-         /* permute the key buffers */
-         memcpy(ta, tk, sizeof(char)*n*kbsd);
-
-         for (i = 0, kb = (LPBYTE)ta; i < n; i++, *t += kbsd1) {
-            t = &GrpKB[*kb]; ss = *t; tt = kb + 1;
+         /* permute the key buffers, unless they are in order already */
+         memcpy(ta, tk, sizeof(char)*gs*BS);
 
-            for (j = 0; j < kbsd1; j++) {
-               *ss = *tt; ss++; tt++;
-            }
-            kb += kbsd;
+         for (i = 0, kb = (LPBYTE)ta; i < gs; i++, kb += BS) {
+            t = &GrpKB[kb[d]]; memcpy(*t, kb, BS); *t += BS;
          }
 
          /* down 1 level */
@@ -234,18 +237,67 @@ CRadix(LPPSTR a, UINT n)
             else if (count[i] > 1 && i > 0)
                isort(ak, count[i], stage);
 
-            ak += count[i]; ax += count[i]*(kbsd1);
+            ak += count[i]; ax += count[i]*BS;
             count[i] = 0;
          }
       }
       else
-         RDFK(GrpKP, a, n, ta, count, stage);
+         RDFK(GrpKP, a, n, ta, count, stage, stack);
    }
 
    free((void*)tj);
    free((void*)ta);
 }
 
+/*
+ * Estimate the average distinguishing prefix from an evenly spaced sample:
+ * the average LCP of the sorted sample, plus the characters needed to tell
+ * apart the strings between two sample neighbours, log(n/m) in base of the
+ * number of distinct characters seen.
+ */
+
+template <typename S>
+static double
+EstimateLCP(S* a, UINT n)
+{
+   UINT i, k, m = std::min(n, SN), lcp = 0, seen[AS] = { 0 }, sigma = 0;
+   std::vector<LPSTR> smp(m);
+   LPSTR s, t;
+
+   for (i = 0; i < m; i++) smp[i] = str_of(a[i * (n / m)]);
+
+   std::sort(smp.begin(), smp.end(),
+      [](LPSTR x, LPSTR y) { return scmp(x, y) < 0; });
+
+   for (i = 1; i < m; i++) {
+      s = smp[i - 1]; t = smp[i];
+      for (k = 0; s[k] == t[k] && s[k] != 0; k++) ;
+      seen[s[k] & (AS-1)] = seen[t[k] & (AS-1)] = 1;
+      lcp += k;
+   }
+
+   for (i = 0; i < AS; i++) sigma += seen[i];
+   if (sigma < 2) sigma = 2;
+
+   return (m > 1 ? (double)lcp / (m - 1) : 0.0) + log((double)n / m) / log(sigma);
+}
+
+template <typename S>
+static void
+Sort(S* a, UINT n)
+{
+   double lcp = (n > 1) ? EstimateLCP(a, n) : 0.0;
+
+   // Wider buffers cost more to scan at every level, and only pay off once
+   // refills are frequent enough; the thresholds are measured
+   if (lcp < 16.0)
+      CRadix<4>(a, n);
+   else if (lcp < 96.0)
+      CRadix<8>(a, n);
+   else
+      CRadix<16>(a, n);
+}
+
 #undef push
 #undef pop
 #undef stackempty
@@ -255,6 +307,11 @@ CRadix(LPPSTR a, UINT n)
 
 void sort_main(char **a, size_t n)
 {
-   ng_cradix::CRadix(a, n);
+   ng_cradix::Sort(a, n);
+}
+
+void sort_main(offset_t *a, size_t n)
+{
+   ng_cradix::Sort(a, n);
 }
 
@@ -0,0 +1,180 @@
+
+/*
+ * Job protocol of the sort server (--serve, --connect).
+ *
+ * A client connects to the server's Unix domain socket and sends one job:
+ * its working directory and its arguments as NUL-terminated strings, after
+ * their total length as uint32_t. The standard input, output and error of
+ * the client come along with the length (SCM_RIGHTS), so that the job reads
+ * and writes as if run by the client. The server replies with the exit
+ * status of the job, an int32_t, once done.
+ *
+ * The code presented in this file has been tested with care but is not
+ * guaranteed for any purpose. The writer does not offer any warranties
+ * nor does he accept any liabilities with respect to the code.
+ */
+
+#ifndef SERVE_H
+#define SERVE_H
+
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+#include "dist.h"
+
+#define SERVE_MAX_JOB 1048576    // bytes of arguments
+#define SERVE_TIMEOUT 5          // seconds to wait on a client for its job
+
+struct serve_job {
+   char *buf, *cwd;
+   char **argv;
+   int argc, fd[3];
+};
+
+// Sends the job made of cwd and argv[0..argc) with fds 0, 1 and 2. Returns
+// 0 on success, -1 otherwise.
+
+static int
+serve_send_job(int sock, const char *cwd, int argc, char **argv)
+{
+   char cbuf[CMSG_SPACE(sizeof(int) * 3)];
+   struct cmsghdr *cm;
+   struct msghdr msg;
+   struct iovec iov;
+   uint32_t len;
+   size_t size;
+   char *buf;
+   int i;
+
+   size = strlen(cwd) + 1;
+   for (i = 0; i < argc; i++)
+      size += strlen(argv[i]) + 1;
+
+   if (size > SERVE_MAX_JOB || (buf = (char *)malloc(size)) == NULL)
+      return -1;
+
+   strcpy(buf, cwd);  len = strlen(cwd) + 1;
+   for (i = 0; i < argc; i++) {
+      strcpy(buf + len, argv[i]);  len += strlen(argv[i]) + 1;
+   }
+
+   memset(&msg, 0, sizeof(msg));
+   memset(cbuf, 0, sizeof(cbuf));
+   iov.iov_base = &len;  iov.iov_len = sizeof(len);
+   msg.msg_iov = &iov;  msg.msg_iovlen = 1;
+   msg.msg_control = cbuf;  msg.msg_controllen = sizeof(cbuf);
+
+   cm = CMSG_FIRSTHDR(&msg);
+   cm->cmsg_level = SOL_SOCKET;  cm->cmsg_type = SCM_RIGHTS;
+   cm->cmsg_len = CMSG_LEN(sizeof(int) * 3);
+   for (i = 0; i < 3; i++)
+      memcpy(CMSG_DATA(cm) + sizeof(int) * i, &i, sizeof(int));
+
+   if (sendmsg(sock, &msg, MSG_NOSIGNAL) != sizeof(len) ||
+         dist_write(sock, buf, len) != 0) {
+      free((void *)buf); return -1;
+   }
+
+   free((void *)buf);
+   return 0;
+}
+
+// Receives a job. Returns 0 on success, -1 otherwise, closing the fds that
+// came along. A read that waits longer than SERVE_TIMEOUT fails, so that a
+// client sending nothing cannot hold up the jobs queued behind it. Jobs
+// other than three fds, and a payload of NUL-terminated strings holding
+// the directory and at least argv[0], are rejected.
+
+static int
+serve_recv_job(int sock, serve_job *job)
+{
+   char cbuf[CMSG_SPACE(sizeof(int) * 3)];
+   struct cmsghdr *cm;
+   struct timeval tv = { SERVE_TIMEOUT, 0 };
+   struct msghdr msg;
+   struct iovec iov;
+   uint32_t len = 0;
+   size_t k, j;
+   ssize_t r;
+   int i, fd, nfd = 0;
+
+   memset(job, 0, sizeof(serve_job));
+   job->fd[0] = job->fd[1] = job->fd[2] = -1;
+
+   if (setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv)) != 0)
+      return -1;
+
+   memset(&msg, 0, sizeof(msg));
+   memset(cbuf, 0, sizeof(cbuf));
+   iov.iov_base = &len;  iov.iov_len = sizeof(len);
+   msg.msg_iov = &iov;  msg.msg_iovlen = 1;
+   msg.msg_control = cbuf;  msg.msg_controllen = sizeof(cbuf);
+
+   if ((r = recvmsg(sock, &msg, MSG_CMSG_CLOEXEC)) < 0)
+      return -1;
+
+   // Take every fd that arrived, so that all are closed on rejection
+   for (cm = CMSG_FIRSTHDR(&msg); cm != NULL; cm = CMSG_NXTHDR(&msg, cm)) {
+      if (cm->cmsg_level != SOL_SOCKET || cm->cmsg_type != SCM_RIGHTS)
+         continue;
+
+      k = (cm->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+
+      for (j = 0; j < k; j++, nfd++) {
+         memcpy(&fd, CMSG_DATA(cm) + sizeof(int) * j, sizeof(int));
+         if (nfd < 3) job->fd[nfd] = fd; else close(fd);
+      }
+   }
+
+   if (r != sizeof(len) || (msg.msg_flags & MSG_CTRUNC) || nfd != 3 ||
+         len == 0 || len > SERVE_MAX_JOB ||
+         (job->buf = (char *)malloc(len + 1)) == NULL ||
+         dist_read(sock, job->buf, len) != 0 || job->buf[len - 1] != '\0') {
+      goto fail;
+   }
+
+   job->buf[len] = '\0';
+
+   // The working directory, then the arguments
+   for (i = 0; i < (int)len; i++)
+      if (job->buf[i] == '\0') job->argc++;
+
+   if (job->argc < 2 ||
+         (job->argv = (char **)malloc(sizeof(char *) * job->argc)) == NULL)
+      goto fail;
+
+   job->cwd = job->buf;  job->argc--;
+
+   for (i = 0, len = strlen(job->cwd) + 1; i < job->argc; i++) {
+      job->argv[i] = job->buf + len;  len += strlen(job->argv[i]) + 1;
+   }
+
+   job->argv[job->argc] = NULL;
+   return 0;
+
+fail:
+   for (i = 0; i < 3; i++)
+      if (job->fd[i] >= 0) close(job->fd[i]);
+
+   free((void *)job->buf);
+   return -1;
+}
+
+static void
+serve_free_job(serve_job *job)
+{
+   int i;
+
+   for (i = 0; i < 3; i++)
+      if (job->fd[i] >= 0) close(job->fd[i]);
+
+   free((void *)job->argv); free((void *)job->buf);
+}
+
+#endif
@@ -0,0 +1,107 @@
+
+/*
+ * Reads a sorted index written with --index.
+ *
+ * The code presented in this file has been tested with care but is not
+ * guaranteed for any purpose. The writer does not offer any warranties
+ * nor does he accept any liabilities with respect to the code.
+ *
+ * usage: sidx info index
+ *        sidx cat index file [first [count]]
+ *        sidx find index file prefix
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sidx.h"
+
+static char output_buf[524288];   // 512K
+
+static void
+usage(char *name)
+{
+   fprintf(stderr, "usage: %s info index\n", name);
+   fprintf(stderr, "       %s cat index file [first [count]]\n", name);
+   fprintf(stderr, "       %s find index file prefix\n", name);
+   exit(1);
+}
+
+// Write the lines of entries [first, last) to stdout
+
+static void
+output_range(sidx *ix, uint64_t first, uint64_t last)
+{
+   const char *s;
+   size_t len;
+
+   for (; first < last; first++) {
+      s = sidx_line(ix, first, &len);
+      fwrite(s, 1, len, stdout); putchar('\n');
+   }
+}
+
+int main(int argc, char *argv[])
+{
+   uint64_t first, last, n;
+   sidx ix;
+
+   if (argc < 3)
+      usage(argv[0]);
+
+   if (strcmp(argv[1], "info") == 0) {
+      if (sidx_open(&ix, argv[2], NULL) != 0) {
+         fprintf(stderr, "%s: %s is not a sorted index\n", argv[0], argv[2]);
+         exit(1);
+      }
+
+      printf("lines:   %llu\n", (unsigned long long)ix.hdr->n);
+      printf("size:    %llu\n", (unsigned long long)ix.hdr->size);
+      printf("offsets: %d-bit\n", (ix.hdr->flags & SIDX_WIDE) ? 64 : 32);
+      printf("lcp:     %s\n", (ix.hdr->flags & SIDX_LCP) ? "yes" : "no");
+      printf("order:   %s\n",
+         (ix.hdr->flags & SIDX_REVERSE) ? "descending" : "ascending");
+
+      sidx_close(&ix);
+      return 0;
+   }
+
+   if (argc < 4)
+      usage(argv[0]);
+
+   if (sidx_open(&ix, argv[2], argv[3]) != 0) {
+      fprintf(stderr, "%s: %s is not a sorted index of %s\n",
+         argv[0], argv[2], argv[3]);
+      exit(1);
+   }
+
+   setvbuf(stdout, output_buf, _IOFBF, sizeof(output_buf));
+   n = sidx_count(&ix);
+
+   if (strcmp(argv[1], "cat") == 0) {
+      first = (argc > 4) ? strtoull(argv[4], NULL, 10) : 0;
+      last  = (argc > 5) ? first + strtoull(argv[5], NULL, 10) : n;
+
+      if (first > n) first = n;
+      if (last > n || last < first) last = n;
+
+      output_range(&ix, first, last);
+   }
+   else if (strcmp(argv[1], "find") == 0 && argc > 4) {
+      size_t klen = strlen(argv[4]);
+
+      first = sidx_lower_bound(&ix, argv[4], klen);
+      last  = sidx_upper_bound(&ix, argv[4], klen);
+
+      output_range(&ix, first, last);
+   }
+   else {
+      usage(argv[0]);
+   }
+
+   fflush(stdout);
+   sidx_close(&ix);
+
+   return 0;
+}
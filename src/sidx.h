@@ -0,0 +1,233 @@
+
+/*
+ * Sorted index format and reader.
+ *
+ * A sorted index records the order of the lines of a text file without
+ * copying the text. It is written by the sort binaries with --index=FILE,
+ * or by the mce-sort wrappers, and read with the functions below.
+ *
+ * The code presented in this file has been tested with care but is not
+ * guaranteed for any purpose. The writer does not offer any warranties
+ * nor does he accept any liabilities with respect to the code.
+ *
+ * Layout, all integers little-endian:
+ *
+ *    header      32 bytes, see sidx_header
+ *    offsets     n entries, uint32_t or uint64_t with SIDX_WIDE, the byte
+ *                offset of each line in the text file, in sorted order
+ *    lcps        n entries of uint32_t with SIDX_LCP, the length of the
+ *                common prefix of each line and the one before it
+ */
+
+#ifndef SIDX_H
+#define SIDX_H
+
+#include <stdint.h>
+#include <string.h>
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#include <fcntl.h>
+
+#define SIDX_MAGIC    "MCESIDX1"
+
+#define SIDX_WIDE     0x1   // 64-bit offsets, the text is 4 GiB or larger
+#define SIDX_LCP      0x2   // LCP array follows the offsets
+#define SIDX_REVERSE  0x4   // lines are in descending order
+
+struct sidx_header {
+   char     magic[8];
+   uint64_t n;              // number of lines
+   uint64_t size;           // size of the text file
+   uint32_t flags;
+   uint32_t reserved;
+};
+
+static inline size_t
+sidx_offset_size(uint32_t flags)
+{
+   return (flags & SIDX_WIDE) ? sizeof(uint64_t) : sizeof(uint32_t);
+}
+
+// Positions of the offset and LCP of entry i within the index file
+
+static inline off_t
+sidx_offset_pos(const sidx_header *h, uint64_t i)
+{
+   return sizeof(sidx_header) + i * sidx_offset_size(h->flags);
+}
+
+static inline off_t
+sidx_lcp_pos(const sidx_header *h, uint64_t i)
+{
+   return sidx_offset_pos(h, h->n) + i * sizeof(uint32_t);
+}
+
+// ############################################################################
+
+// An index opened together with its text file, both mapped read-only
+
+struct sidx {
+   sidx_header *hdr;
+   const char *base, *text;
+   size_t base_size, text_size;
+};
+
+static inline int
+sidx_map(const char *name, const char **p, size_t *sizep)
+{
+   struct stat st;
+   void *m = NULL;
+   int fd;
+
+   if ((fd = open(name, O_RDONLY)) < 0)
+      return -1;
+
+   if (fstat(fd, &st) != 0) {
+      close(fd); return -1;
+   }
+
+   if (st.st_size > 0 && (m = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED,
+         fd, 0)) == MAP_FAILED) {
+      close(fd); return -1;
+   }
+
+   close(fd);
+
+   *p = (const char *)m; *sizep = st.st_size;
+   return 0;
+}
+
+// Returns 0 on success, -1 if either file cannot be mapped, or the index is
+// malformed or does not match the size of the text.
+
+static inline int
+sidx_open(sidx *ix, const char *index_name, const char *text_name)
+{
+   memset(ix, 0, sizeof(sidx));
+
+   if (sidx_map(index_name, &ix->base, &ix->base_size) != 0)
+      return -1;
+
+   ix->hdr = (sidx_header *)ix->base;
+
+   if (ix->base_size < sizeof(sidx_header) ||
+         memcmp(ix->hdr->magic, SIDX_MAGIC, 8) != 0 ||
+         (size_t)sidx_lcp_pos(ix->hdr, (ix->hdr->flags & SIDX_LCP)
+            ? ix->hdr->n : 0) > ix->base_size) {
+      munmap((void *)ix->base, ix->base_size);
+      return -1;
+   }
+
+   if (text_name == NULL)
+      return 0;
+
+   if (sidx_map(text_name, &ix->text, &ix->text_size) != 0 ||
+         ix->text_size != ix->hdr->size) {
+      if (ix->text) munmap((void *)ix->text, ix->text_size);
+      munmap((void *)ix->base, ix->base_size);
+      return -1;
+   }
+
+   return 0;
+}
+
+static inline void
+sidx_close(sidx *ix)
+{
+   if (ix->text) munmap((void *)ix->text, ix->text_size);
+   if (ix->base) munmap((void *)ix->base, ix->base_size);
+
+   memset(ix, 0, sizeof(sidx));
+}
+
+static inline uint64_t
+sidx_count(const sidx *ix)
+{
+   return ix->hdr->n;
+}
+
+static inline uint64_t
+sidx_offset(const sidx *ix, uint64_t i)
+{
+   const char *p = ix->base + sidx_offset_pos(ix->hdr, i);
+
+   if (ix->hdr->flags & SIDX_WIDE)
+      return *(const uint64_t *)p;
+   else
+      return *(const uint32_t *)p;
+}
+
+// LCP of entry i with entry i - 1, or 0 when the index has no LCPs
+
+static inline uint32_t
+sidx_lcp(const sidx *ix, uint64_t i)
+{
+   if (!(ix->hdr->flags & SIDX_LCP))
+      return 0;
+
+   return *(const uint32_t *)(ix->base + sidx_lcp_pos(ix->hdr, i));
+}
+
+// The i-th line in sorted order, without its newline
+
+static inline const char *
+sidx_line(const sidx *ix, uint64_t i, size_t *lenp)
+{
+   const char *s = ix->text + sidx_offset(ix, i), *e;
+
+   e = (const char *)memchr(s, '\n', ix->text + ix->text_size - s);
+   *lenp = (e != NULL) ? e - s : ix->text + ix->text_size - s;
+
+   return s;
+}
+
+// Compare the first klen bytes of line i with key. Lines are ordered as
+// the sort binaries order them, by unsigned bytes.
+
+static inline int
+sidx_compare(const sidx *ix, uint64_t i, const char *key, size_t klen)
+{
+   size_t len;
+   const char *s = sidx_line(ix, i, &len);
+   int c = memcmp(s, key, (len < klen) ? len : klen);
+
+   if (c == 0)
+      c = (len < klen) ? -1 : 0;
+
+   return (ix->hdr->flags & SIDX_REVERSE) ? -c : c;
+}
+
+// First entry whose line does not precede key in index order, comparing at
+// most klen bytes. With lower and upper bounds of the same key the lines
+// starting with key are the entries in [lower, upper).
+
+static inline uint64_t
+sidx_lower_bound(const sidx *ix, const char *key, size_t klen)
+{
+   uint64_t lo = 0, hi = ix->hdr->n, mid;
+
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (sidx_compare(ix, mid, key, klen) < 0) lo = mid + 1; else hi = mid;
+   }
+
+   return lo;
+}
+
+static inline uint64_t
+sidx_upper_bound(const sidx *ix, const char *key, size_t klen)
+{
+   uint64_t lo = 0, hi = ix->hdr->n, mid;
+
+   while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (sidx_compare(ix, mid, key, klen) <= 0) lo = mid + 1; else hi = mid;
+   }
+
+   return lo;
+}
+
+#endif
@@ -28,6 +28,7 @@
  */
 
 #include "main.h"
+#include "msd_oop.h"
 #include <string>
 
 namespace tb_radix {
@@ -36,31 +37,31 @@ static const size_t g_inssort_threshold = 64;
 
 typedef char* string;
 
-template <typename CharT>
-inline CharT get_char(string ptr, size_t depth);
+// Wide digits are taken from the 14-bit key of two 7-bit characters. A
+// w-bit digit is the top w bits of the key, so w = 14 resolves both
+// characters and w = 11 or 12 the first one and part of the second.
 
-template <>
-inline uint16_t get_char<uint16_t>(string str, size_t depth)
+static const unsigned KEY_BITS = 14;
+
+static inline uint16_t
+get_digit(string str, size_t depth, unsigned w)
 {
-    uint16_t v = 0;
-    if (str[depth] == 0) return v;
-    v |= (uint16_t(str[depth]) << 8); ++str;
-    v |= (uint16_t(str[depth]) << 0);
-    return v;
+    uint16_t v = uint16_t(uint8_t(str[depth])) << 7;
+    if (v) v |= uint8_t(str[depth+1]);
+    return v >> (KEY_BITS - w);
 }
 
+template <typename S>
 static inline void
-inssort(string* str, size_t n, size_t d)
+inssort(S* str, size_t n, size_t d)
 {
-    string *pj, s, t;
+    S *pj;
 
-    for (string* pi = str + 1; --n > 0; pi++) {
-        string tmp = *pi;
+    for (S* pi = str + 1; --n > 0; pi++) {
+        S tmp = *pi;
 
         for (pj = pi; pj > str; pj--) {
-            for (s = *(pj-1)+d, t = tmp+d; *s == *t && *s != 0; ++s, ++t)
-                ;
-            if (*s <= *t)
+            if (scmp(str_of(*(pj-1))+d, str_of(tmp)+d) <= 0)
                 break;
             *pj = *(pj-1);
         }
@@ -68,19 +69,25 @@ inssort(string* str, size_t n, size_t d)
     }
 }
 
+template <typename S>
 static inline size_t*
-msd_CI5_bktsize(string* strings, size_t n, size_t depth)
+msd_CI5_bktsize(S* strings, size_t n, size_t depth,
+                const size_t* counts = NULL)
 {
     // cache characters
     uint8_t* charcache = new uint8_t[n];
     for (size_t i=0; i < n; ++i)
-        charcache[i] = strings[i][depth];
+        charcache[i] = str_of(strings[i])[depth];
 
-    // count character occurances
+    // count character occurances, unless known beforehand
     size_t* bktsize = new size_t[128];
-    memset(bktsize, 0, 128 * sizeof(size_t));
-    for (size_t i=0; i < n; ++i)
-        ++bktsize[ charcache[i] ];
+    if (counts)
+        memcpy(bktsize, counts, 128 * sizeof(size_t));
+    else {
+        memset(bktsize, 0, 128 * sizeof(size_t));
+        for (size_t i=0; i < n; ++i)
+            ++bktsize[ charcache[i] ];
+    }
 
     // inclusive prefix sum
     size_t bkt[128];
@@ -94,7 +101,7 @@ msd_CI5_bktsize(string* strings, size_t n, size_t depth)
     // premute in-place
     for (size_t i=0, j; i < n-last_bkt_size; )
     {
-        string perm = strings[i];
+        S perm = strings[i];
         uint8_t permch = charcache[i];
         while ( (j = --bkt[ permch ]) > i )
         {
@@ -110,13 +117,14 @@ msd_CI5_bktsize(string* strings, size_t n, size_t depth)
     return bktsize;
 }
 
+template <typename S>
 void
-msd_CI5(string* strings, size_t n, size_t depth)
+msd_CI5(S* strings, size_t n, size_t depth, const size_t* counts = NULL)
 {
     if (n < g_inssort_threshold)
         return inssort(strings, n, depth);
 
-    size_t* bktsize = msd_CI5_bktsize(strings, n, depth);
+    size_t* bktsize = msd_CI5_bktsize(strings, n, depth, counts);
 
     // recursion
     size_t bsum = bktsize[0];
@@ -129,35 +137,46 @@ msd_CI5(string* strings, size_t n, size_t depth)
     delete [] bktsize;
 }
 
+// The histogram and bucket ends of the widest digit are kept across calls
+// and left zeroed, as only the entries of non-empty buckets are touched.
+// Those are found from a bitmap of the digits seen, so a level costs O(n)
+// plus a word per 64 buckets rather than a walk over all 2^w buckets. The
+// sizes of the non-empty buckets are returned in the order of used[].
+
+template <typename S>
 static inline size_t*
-msd_CI5_16bit_bktsize(string* strings, size_t n, size_t depth)
+msd_CI5_wide_bktsize(S* strings, size_t n, size_t depth, unsigned w,
+                     uint16_t* used, size_t* nused)
 {
-    static const size_t RADIX = 0x10000;
+    static size_t* hist = new size_t[size_t(2) << KEY_BITS]();
+    size_t* bkt = hist + (size_t(1) << KEY_BITS);
+    uint64_t seen[1 << (KEY_BITS - 6)] = { 0 };
 
-    // cache characters
+    // cache characters, counting them and noting the digits seen
     uint16_t* charcache = new uint16_t[n];
-    for (size_t i=0; i < n; ++i)
-        charcache[i] = get_char<uint16_t>(strings[i], depth);
-
-    // count character occurances
-    size_t* bktsize = new size_t[RADIX];
-    memset(bktsize, 0, RADIX * sizeof(size_t));
-    for (size_t i=0; i < n; ++i)
-        ++bktsize[ charcache[i] ];
+    for (size_t i=0; i < n; ++i) {
+        uint16_t c = get_digit(str_of(strings[i]), depth, w);
+        charcache[i] = c;
+        ++hist[c];
+        seen[c >> 6] |= uint64_t(1) << (c & 63);
+    }
 
-    // inclusive prefix sum
-    size_t bkt[RADIX];
-    bkt[0] = bktsize[0];
-    size_t last_bkt_size = bktsize[0];
-    for (unsigned i=1; i < RADIX; ++i) {
-        bkt[i] = bkt[i-1] + bktsize[i];
-        if (bktsize[i]) last_bkt_size = bktsize[i];
+    // inclusive prefix sum over the non-empty buckets, in digit order
+    size_t sum = 0, k = 0;
+    for (unsigned x=0; x < (1u << w) / 64; ++x) {
+        for (uint64_t b = seen[x]; b; b &= b - 1) {
+            unsigned i = x * 64 + __builtin_ctzll(b);
+            bkt[i] = sum += hist[i];
+            used[k++] = i;
+        }
     }
+    *nused = k;
+    size_t last_bkt_size = hist[used[k-1]];
 
     // premute in-place
     for (size_t i=0, j; i < n-last_bkt_size; )
     {
-        string perm = strings[i];
+        S perm = strings[i];
         uint16_t permch = charcache[i];
         while ( (j = --bkt[ permch ]) > i )
         {
@@ -165,31 +184,97 @@ msd_CI5_16bit_bktsize(string* strings, size_t n, size_t depth)
             std::swap(permch, charcache[j]);
         }
         strings[i] = perm;
-        i += bktsize[ permch ];
+        i += hist[ permch ];
     }
 
     delete [] charcache;
 
+    // hand over the sizes, clearing the histogram for the next call
+    size_t* bktsize = new size_t[k];
+    for (size_t j=0; j < k; ++j) {
+        bktsize[j] = hist[used[j]];
+        hist[used[j]] = 0;
+    }
+
     return bktsize;
 }
 
-static void
-msd_CI5_16bit(string* strings, size_t n, size_t depth)
+// Pick the digit width for a level. The widest of 14, 12 and 11 bits whose
+// histogram fits in the L2 cache is used when the sampled strings share few
+// two-character prefixes, as then only a few buckets are touched and two
+// characters are resolved per pass. For dense samples a wide histogram is
+// only worth filling when n is at least four times its size; otherwise,
+// and below 4096 strings, one 7-bit character is used.
+
+template <typename S>
+static unsigned
+choose_width(S* strings, size_t n, size_t depth)
 {
-    if (n < 0x10000)
-        return msd_CI5(strings, n, depth);
+    static const size_t SAMPLE = 256;
+    static const unsigned widths[] = { 14, 12, 11 };
+    static size_t l2 = 0;
+    unsigned w = 7;
 
-    size_t* bktsize = msd_CI5_16bit_bktsize(strings, n, depth);
+    if (n < 4096)
+        return 7;
 
-    // recursion
-    size_t bsum = bktsize[0];
-    for (size_t i=1; i < 0x10000; ++i) {
-        if (bktsize[i] == 0) continue;
-        if (i & 0xFF) // not zero-terminated
-            msd_CI5_16bit(strings+bsum, bktsize[i], depth+2);
-        bsum += bktsize[i];
+    if (l2 == 0) {
+        long v = sysconf(_SC_LEVEL2_CACHE_SIZE);
+        l2 = (v > 0) ? v : 262144;
+    }
+
+    for (unsigned x : widths) {
+        if ((size_t(2) << x) * sizeof(size_t) <= l2) { w = x; break; }
+    }
+
+    // distinct two-character prefixes in the sample
+    uint64_t seen[1 << (KEY_BITS - 6)] = { 0 };
+    size_t d2 = 0;
+
+    for (size_t i=0; i < SAMPLE; ++i) {
+        uint16_t k = get_digit(str_of(strings[i * (n / SAMPLE)]), depth,
+                               KEY_BITS);
+        uint64_t b = uint64_t(1) << (k & 63);
+
+        if (!(seen[k >> 6] & b)) { seen[k >> 6] |= b; ++d2; }
     }
 
+    if (d2 <= SAMPLE / 8 || (size_t(1) << w) <= n / 4)
+        return w;
+
+    return 7;
+}
+
+template <typename S>
+static void
+msd_CI5_wide(S* strings, size_t n, size_t depth,
+             const size_t* counts = NULL)
+{
+    unsigned w = choose_width(strings, n, depth);
+
+    if (w == 7)
+        return msd_CI5(strings, n, depth, counts);
+
+    uint16_t* used = new uint16_t[size_t(1) << w];
+    size_t nused;
+    size_t* bktsize = msd_CI5_wide_bktsize(strings, n, depth, w, used, &nused);
+
+    // recursion over the non-empty buckets, skipping terminated strings:
+    // digit 0 ends at depth, and with both characters resolved, a zero
+    // second character ends at depth+1
+    size_t bsum = 0;
+    for (size_t k=0; k < nused; ++k) {
+        unsigned i = used[k];
+        if (i == 0)
+            ;
+        else if (w < KEY_BITS)
+            msd_CI5_wide(strings+bsum, bktsize[k], depth+1);
+        else if (i & 0x7F)
+            msd_CI5_wide(strings+bsum, bktsize[k], depth+2);
+        bsum += bktsize[k];
+    }
+
+    delete [] used;
     delete [] bktsize;
 }
 
@@ -197,6 +282,11 @@ msd_CI5_16bit(string* strings, size_t n, size_t depth)
 
 void sort_main(char **a, size_t n)
 {
-   tb_radix::msd_CI5_16bit(a, n, 0);
+   msd_oop_sort(a, n, depth0_hist, tb_radix::msd_CI5_wide<char *>);
+}
+
+void sort_main(offset_t *a, size_t n)
+{
+   msd_oop_sort(a, n, depth0_hist, tb_radix::msd_CI5_wide<offset_t>);
 }
 
@@ -26,6 +26,9 @@
  *  - double sweep counting sort
  *  - O(n) oracle to reduce cache misses and memory stalls
  *  - the in-place distribution method described by McIlroy, Bostic & McIlroy
+ *
+ * msd_oop() (msd_oop.h) distributes out of place for large n and hands
+ * smaller buckets to msd_ci().
  */
 
 /*
@@ -33,31 +36,19 @@
  */
 
 #include "main.h"
+#include "msd_oop.h"
 
 namespace rantala {
 
-template <typename CharT>
-inline bool is_end(CharT c);
-
-template <> inline bool is_end(char c)
-{
-    return c==0;
-}
-
+template <typename S>
 static inline void
-insertion_sort(char** strings, size_t n, size_t depth)
+insertion_sort(S* strings, size_t n, size_t depth)
 {
-    for (char** i = strings + 1; --n > 0; ++i) {
-        char** j = i;
-        char* tmp = *i;
+    for (S* i = strings + 1; --n > 0; ++i) {
+        S* j = i;
+        S tmp = *i;
         while (j > strings) {
-            char* s = *(j-1)+depth;
-            char* t = tmp+depth;
-            while (*s == *t and not is_end(*s)) {
-                ++s;
-                ++t;
-            }
-            if (*s <= *t) break;
+            if (scmp(str_of(*(j-1))+depth, str_of(tmp)+depth) <= 0) break;
             *j = *(j-1);
             --j;
         }
@@ -65,15 +56,16 @@ insertion_sort(char** strings, size_t n, size_t depth)
     }
 }
 
-template <typename BucketType>
+template <typename S, typename BucketType>
 struct distblock {
-    char* ptr;
+    S ptr;
     BucketType bucket;
 };
 
-template <typename BucketsizeType>
+// The counts may be supplied by the caller, e.g. gathered while loading.
+template <typename BucketsizeType, typename S>
 static void
-msd_ci(char** strings, size_t n, size_t depth){
+msd_ci(S* strings, size_t n, size_t depth, const size_t* counts = NULL){
     if (n < 64) {
         insertion_sort(strings, n, depth);
         return;
@@ -82,9 +74,13 @@ msd_ci(char** strings, size_t n, size_t depth){
     char* restrict oracle =
         (char*) malloc(n);
     for (size_t i=0; i < n; ++i)
-        oracle[i] = strings[i][depth];
-    for (size_t i=0; i < n; ++i)
-        ++bucketsize[oracle[i]];
+        oracle[i] = str_of(strings[i])[depth];
+    if (counts)
+        for (unsigned i=0; i < 128; ++i)
+            bucketsize[i] = counts[i];
+    else
+        for (size_t i=0; i < n; ++i)
+            ++bucketsize[oracle[i]];
     static size_t bucketindex[128];
     bucketindex[0] = bucketsize[0];
     BucketsizeType last_bucket_size = bucketsize[0];
@@ -93,7 +89,7 @@ msd_ci(char** strings, size_t n, size_t depth){
         if (bucketsize[i]) last_bucket_size = bucketsize[i];
     }
     for (size_t i=0; i < n-last_bucket_size; ) {
-        distblock<int8_t> tmp = { strings[i], oracle[i] };
+        distblock<S, int8_t> tmp = { strings[i], oracle[i] };
         while (1) {
             // Continue until the current bucket is completely in
             // place
@@ -102,7 +98,7 @@ msd_ci(char** strings, size_t n, size_t depth){
             // backup all information of the position we are about
             // to overwrite
             size_t backup_idx = bucketindex[tmp.bucket];
-            distblock<int8_t> tmp2 = { strings[backup_idx], oracle[backup_idx] };
+            distblock<S, int8_t> tmp2 = { strings[backup_idx], oracle[backup_idx] };
             // overwrite everything, ie. move the string to correct
             // position
             strings[backup_idx] = tmp.ptr;
@@ -118,18 +114,29 @@ msd_ci(char** strings, size_t n, size_t depth){
     size_t bsum = bucketsize[0];
     for (size_t i=1; i < 128; ++i) {
         if (bucketsize[i] == 0) continue;
-        msd_ci<BucketsizeType>(strings+bsum, bucketsize[i], depth+1);
+        msd_ci<BucketsizeType, S>(strings+bsum, bucketsize[i], depth+1);
         bsum += bucketsize[i];
     }
 }
 
-void msd_ci(char** strings, size_t n, size_t depth)
-{ msd_ci<size_t>(strings, n, depth); }
+template <typename S>
+void msd_ci(S* strings, size_t n, size_t depth, const size_t* counts)
+{ msd_ci<size_t, S>(strings, n, depth, counts); }
+
+template <typename S>
+static void
+msd(S* strings, size_t n, const size_t* counts)
+{ msd_oop_sort(strings, n, counts, msd_ci<size_t, S>); }
 
 } // namespace rantala
 
 void sort_main(char **a, size_t n)
 {
-   rantala::msd_ci(a, n, 0);
+   rantala::msd(a, n, depth0_hist);
+}
+
+void sort_main(offset_t *a, size_t n)
+{
+   rantala::msd(a, n, depth0_hist);
 }
 